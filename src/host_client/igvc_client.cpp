@@ -0,0 +1,372 @@
+#include "igvc_client.h"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <pb_decode.h>
+#include <pb_encode.h>
+
+namespace
+{
+/* a uint32 varint is at most 5 bytes long */
+constexpr size_t MAX_VARINT_LENGTH = 5;
+// large enough for any datagram, and a few TCP responses at once
+constexpr size_t RECV_CHUNK = 4096 > ResponseMessage_size ? 4096 : ResponseMessage_size;
+}  // namespace
+
+IgvcClient::~IgvcClient()
+{
+  close();
+}
+
+bool IgvcClient::connect(const std::string &host, uint16_t port, Transport transport_type)
+{
+  close();
+  transport = transport_type;
+  last_error.clear();
+
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = transport == Transport::TCP ? SOCK_STREAM : SOCK_DGRAM;
+  addrinfo *addresses = nullptr;
+  if (int ret = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses); ret != 0)
+  {
+    return fail(std::string("can't resolve ") + host + ": " + gai_strerror(ret));
+  }
+
+  // for UDP, connect() only picks the peer, so that send() and recv() can be used
+  for (addrinfo *address = addresses; address != nullptr && fd < 0; address = address->ai_next)
+  {
+    fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (fd >= 0 && ::connect(fd, address->ai_addr, address->ai_addrlen) != 0)
+    {
+      last_error = std::string("can't connect to ") + host + ": " + strerror(errno);
+      ::close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (fd < 0)
+  {
+    return fail(last_error.empty() ? "can't create a socket" : last_error);
+  }
+
+  if (transport == Transport::TCP)
+  {
+    // requests are small and latency matters more than packet count
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+  last_error.clear();
+  return true;
+}
+
+void IgvcClient::close()
+{
+  if (fd >= 0)
+  {
+    ::close(fd);
+    fd = -1;
+  }
+  send_buffer.clear();
+  receive_buffer.clear();
+  datagrams.clear();
+  has_exchange = false;
+
+  // what was in flight will never be answered
+  while (!pending.empty())
+  {
+    Pending request = std::move(pending.front());
+    pending.pop_front();
+    if (request.callback)
+    {
+      request.callback({ request.seq, nullptr, nowUs() - request.sent_us, request.sent_us });
+    }
+  }
+}
+
+bool IgvcClient::isConnected() const
+{
+  return fd >= 0;
+}
+
+const std::string &IgvcClient::error() const
+{
+  return last_error;
+}
+
+void IgvcClient::setTelemetryCallback(TelemetryCallback callback)
+{
+  telemetry_callback = std::move(callback);
+}
+
+void IgvcClient::setTimeoutUs(uint64_t timeout)
+{
+  timeout_us = timeout;
+}
+
+void IgvcClient::setClockSync(bool enabled)
+{
+  clock_sync = enabled;
+}
+
+uint32_t IgvcClient::send(const RequestMessage &request, ReplyCallback callback)
+{
+  if (fd < 0)
+  {
+    return 0;
+  }
+
+  RequestMessage message = request;
+  uint64_t now_us = nowUs();
+  uint32_t seq = next_seq++;
+  // 0 is left out, so that a seq of 0 can mean no request
+  next_seq += next_seq == 0 ? 1 : 0;
+  message.has_seq = true;
+  message.seq = seq;
+  message.has_host_time_us = true;
+  message.host_time_us = now_us;
+  if (clock_sync)
+  {
+    message.has_clock_sync = true;
+    message.clock_sync = ClockSyncRequest_init_zero;
+    message.clock_sync.t0_us = now_us;
+    if (has_exchange)
+    {
+      message.clock_sync.has_last_t0_us = true;
+      message.clock_sync.has_last_t1_us = true;
+      message.clock_sync.has_last_t2_us = true;
+      message.clock_sync.has_last_t3_us = true;
+      message.clock_sync.last_t0_us = exchange_us[0];
+      message.clock_sync.last_t1_us = exchange_us[1];
+      message.clock_sync.last_t2_us = exchange_us[2];
+      message.clock_sync.last_t3_us = exchange_us[3];
+    }
+  }
+
+  uint8_t buffer[RequestMessage_size + MAX_VARINT_LENGTH];
+  pb_ostream_t ostream = pb_ostream_from_buffer(buffer, sizeof(buffer));
+  bool delimited = transport == Transport::TCP;
+  if (!(delimited ? pb_encode_delimited(&ostream, RequestMessage_fields, &message)
+                  : pb_encode(&ostream, RequestMessage_fields, &message)))
+  {
+    last_error = std::string("encoding failed: ") + PB_GET_ERROR(&ostream);
+    return 0;
+  }
+  if (delimited)
+  {
+    send_buffer.insert(send_buffer.end(), buffer, buffer + ostream.bytes_written);
+  }
+  else
+  {
+    datagrams.emplace_back(buffer, buffer + ostream.bytes_written);
+  }
+
+  pending.push_back({ seq, now_us, std::move(callback) });
+  return flush() ? seq : 0;
+}
+
+bool IgvcClient::poll(int timeout_ms)
+{
+  if (fd < 0)
+  {
+    return false;
+  }
+  pollfd events{ fd, POLLIN, 0 };
+  if (!send_buffer.empty() || !datagrams.empty())
+  {
+    events.events |= POLLOUT;
+  }
+  if (::poll(&events, 1, timeout_ms) < 0 && errno != EINTR)
+  {
+    return fail(std::string("poll failed: ") + strerror(errno));
+  }
+
+  if (!flush() || !receive())
+  {
+    return false;
+  }
+  expire(nowUs());
+  return fd >= 0;
+}
+
+size_t IgvcClient::inFlight() const
+{
+  return pending.size();
+}
+
+size_t IgvcClient::queuedBytes() const
+{
+  size_t bytes = send_buffer.size();
+  for (const std::vector<uint8_t> &datagram : datagrams)
+  {
+    bytes += datagram.size();
+  }
+  return bytes;
+}
+
+uint64_t IgvcClient::nowUs()
+{
+  timespec now{};
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000ull + static_cast<uint64_t>(now.tv_nsec) / 1000;
+}
+
+/* Hands queued requests to the socket, as far as it takes them without blocking */
+bool IgvcClient::flush()
+{
+  while (fd >= 0 && !send_buffer.empty())
+  {
+    ssize_t n = ::send(fd, send_buffer.data(), send_buffer.size(), MSG_NOSIGNAL);
+    if (n < 0)
+    {
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ||
+             fail(std::string("send failed: ") + strerror(errno));
+    }
+    send_buffer.erase(send_buffer.begin(), send_buffer.begin() + n);
+  }
+  while (fd >= 0 && !datagrams.empty())
+  {
+    ssize_t n = ::send(fd, datagrams.front().data(), datagrams.front().size(), MSG_NOSIGNAL);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    {
+      return true;
+    }
+    // nobody listening yet answers with ICMP; the datagram is lost like any other, and times out
+    if (n < 0 && errno != ECONNREFUSED)
+    {
+      return fail(std::string("send failed: ") + strerror(errno));
+    }
+    datagrams.pop_front();
+  }
+  return fd >= 0;
+}
+
+/* Reads everything that arrived and dispatches the complete responses */
+bool IgvcClient::receive()
+{
+  uint8_t chunk[RECV_CHUNK];
+  while (fd >= 0)
+  {
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if (n < 0)
+    {
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ECONNREFUSED ||
+             fail(std::string("recv failed: ") + strerror(errno));
+    }
+    uint64_t received_us = nowUs();
+    if (transport == Transport::UDP)
+    {
+      // every datagram holds exactly one response, without a length prefix
+      dispatch(chunk, static_cast<size_t>(n), received_us);
+      continue;
+    }
+    if (n == 0)
+    {
+      return fail("the mbed closed the connection");
+    }
+
+    receive_buffer.insert(receive_buffer.end(), chunk, chunk + n);
+    size_t offset = 0;
+    while (true)
+    {
+      // the length prefix, a varint
+      uint32_t length = 0;
+      size_t prefix_length = 0;
+      bool complete = false;
+      while (offset + prefix_length < receive_buffer.size() && prefix_length < MAX_VARINT_LENGTH)
+      {
+        uint8_t byte = receive_buffer[offset + prefix_length];
+        length |= static_cast<uint32_t>(byte & 0x7f) << (7 * prefix_length);
+        ++prefix_length;
+        if ((byte & 0x80) == 0)
+        {
+          complete = true;
+          break;
+        }
+      }
+      // checked before waiting for the body, so that a corrupt length doesn't make us buffer up to 4 GB
+      if ((!complete && prefix_length == MAX_VARINT_LENGTH) || (complete && length > ResponseMessage_size))
+      {
+        return fail("response stream corrupt");
+      }
+      if (!complete || receive_buffer.size() - offset - prefix_length < length)
+      {
+        break;
+      }
+      dispatch(&receive_buffer[offset + prefix_length], length, received_us);
+      offset += prefix_length + length;
+    }
+    receive_buffer.erase(receive_buffer.begin(), receive_buffer.begin() + static_cast<ptrdiff_t>(offset));
+  }
+  return false;
+}
+
+void IgvcClient::dispatch(const uint8_t *data, size_t length, uint64_t received_us)
+{
+  ResponseMessage response = ResponseMessage_init_zero;
+  pb_istream_t istream = pb_istream_from_buffer(data, length);
+  if (!pb_decode(&istream, ResponseMessage_fields, &response))
+  {
+    // the length prefix was valid, so the next response still starts in the right place
+    last_error = std::string("decoding failed: ") + PB_GET_ERROR(&istream);
+    return;
+  }
+
+  if (response.has_clock_sync)
+  {
+    has_exchange = true;
+    exchange_us[0] = response.clock_sync.t0_us;
+    exchange_us[1] = response.clock_sync.t1_us;
+    exchange_us[2] = response.clock_sync.t2_us;
+    exchange_us[3] = received_us;
+  }
+
+  // requests that arrived together with the one answered are answered by the same response
+  while (response.has_seq && !pending.empty() && static_cast<int32_t>(response.seq - pending.front().seq) >= 0)
+  {
+    Pending request = std::move(pending.front());
+    pending.pop_front();
+    if (request.callback)
+    {
+      request.callback({ request.seq, &response, received_us - request.sent_us, request.sent_us });
+    }
+  }
+
+  if (telemetry_callback)
+  {
+    telemetry_callback(response);
+  }
+}
+
+void IgvcClient::expire(uint64_t now_us)
+{
+  while (timeout_us != 0 && !pending.empty() && now_us - pending.front().sent_us > timeout_us)
+  {
+    Pending request = std::move(pending.front());
+    pending.pop_front();
+    if (request.callback)
+    {
+      request.callback({ request.seq, nullptr, now_us - request.sent_us, request.sent_us });
+    }
+  }
+}
+
+/* Records the error and drops the connection. @return false, for chaining */
+bool IgvcClient::fail(const std::string &message)
+{
+  std::string error_message = message;
+  close();
+  last_error = error_message;
+  return false;
+}
@@ -0,0 +1,116 @@
+#ifndef IGVC_CLIENT_H
+#define IGVC_CLIENT_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "igvc.pb.h"
+
+/**
+ * Host side of the mbed protocol (see src/mbed/protos/igvc.proto and the README), over TCP or UDP.
+ *
+ * Nothing blocks except poll(). send() writes a request right away, or queues it until the socket takes it,
+ * and returns; any number of requests may be in flight. poll() reads whatever has arrived and calls back.
+ *
+ * Every request gets a seq, and the mbed echoes the seq of the request it answers. It answers all requests
+ * that arrived in one read with a single response, so a response completes every request up to its seq;
+ * each of them gets the response and its own round trip time. Pushed telemetry (push_period_ms) has no seq
+ * and only goes to the telemetry callback, which sees every message that arrives.
+ */
+class IgvcClient
+{
+public:
+  enum class Transport
+  {
+    TCP,
+    UDP
+  };
+
+  struct Reply
+  {
+    // seq of the request; response->seq is a later one's when they were answered together
+    uint32_t seq;
+    const ResponseMessage *response;  // nullptr if the request timed out
+    uint64_t round_trip_us;
+    uint64_t sent_us;  // nowUs() when it was handed to send()
+  };
+
+  using ReplyCallback = std::function<void(const Reply &reply)>;
+  using TelemetryCallback = std::function<void(const ResponseMessage &response)>;
+
+  IgvcClient() = default;
+  IgvcClient(const IgvcClient &) = delete;
+  IgvcClient &operator=(const IgvcClient &) = delete;
+  ~IgvcClient();
+
+  /* Connects, blocking until the TCP handshake is done. @return false with error() set on failure */
+  bool connect(const std::string &host, uint16_t port, Transport transport);
+  void close();
+  bool isConnected() const;
+  const std::string &error() const;
+
+  void setTelemetryCallback(TelemetryCallback callback);
+  /* Requests unanswered for this long are completed with a null response. 0, the default, waits forever */
+  void setTimeoutUs(uint64_t timeout_us);
+  /*
+  Adds clock_sync to every request, reporting the last exchange that completed, so that the mbed
+  synchronizes with this host's clock (see ClockSyncRequest). Only useful for the commander.
+  */
+  void setClockSync(bool enabled);
+
+  /*
+  Sends a request. Its seq and host_time_us are filled in here.
+  @return the seq, or 0 if the request couldn't be encoded or the connection is gone
+  */
+  uint32_t send(const RequestMessage &request, ReplyCallback callback = nullptr);
+
+  /*
+  Waits up to timeout_ms for the socket, then flushes queued requests, reads and dispatches every complete
+  response and expires requests that timed out. 0 only does what can be done without waiting.
+  @return false once the connection is gone
+  */
+  bool poll(int timeout_ms);
+
+  /* Requests sent and not answered yet */
+  size_t inFlight() const;
+  /* Bytes encoded but not taken by the socket yet */
+  size_t queuedBytes() const;
+
+  /* Host clock used for host_time_us and the round trips, microseconds of CLOCK_MONOTONIC */
+  static uint64_t nowUs();
+
+private:
+  struct Pending
+  {
+    uint32_t seq;
+    uint64_t sent_us;
+    ReplyCallback callback;
+  };
+
+  bool flush();
+  bool receive();
+  void dispatch(const uint8_t *data, size_t length, uint64_t received_us);
+  void expire(uint64_t now_us);
+  bool fail(const std::string &message);
+
+  int fd = -1;
+  Transport transport = Transport::TCP;
+  std::string last_error;
+  TelemetryCallback telemetry_callback;
+  uint64_t timeout_us = 0;
+
+  uint32_t next_seq = 1;
+  std::deque<Pending> pending;
+  std::vector<uint8_t> send_buffer;            // TCP: encoded requests the socket hasn't taken yet
+  std::vector<uint8_t> receive_buffer;         // TCP: bytes of responses not complete yet
+  std::deque<std::vector<uint8_t>> datagrams;  // UDP: requests the socket hasn't taken yet
+
+  bool clock_sync = false;
+  bool has_exchange = false;
+  uint64_t exchange_us[4] = {};  // t0..t3 of the last completed exchange
+};
+
+#endif  // IGVC_CLIENT_H
@@ -0,0 +1,266 @@
+/*
+igvc-loadgen: drives the mbed, or the firmware simulator, with requests at a fixed rate and reports the round
+trip latency percentiles and the throughput. See --help.
+*/
+#include <getopt.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "igvc_client.h"
+
+namespace
+{
+struct Options
+{
+  std::string host = "192.168.1.20";
+  uint16_t port = 5333;
+  IgvcClient::Transport transport = IgvcClient::Transport::TCP;
+  double rate_hz = 100.0;
+  double duration_sec = 10.0;
+  uint32_t window = 1;
+  uint32_t timeout_ms = 1000;
+  uint32_t push_period_ms = 0;
+  bool send_speed = false;
+  float speed = 0.0f;
+  bool clock_sync = false;
+};
+
+struct Stats
+{
+  uint32_t sent = 0;
+  uint32_t answered = 0;   // by a response to exactly this request
+  uint32_t coalesced = 0;  // by a response to a later request that arrived in the same read
+  uint32_t timed_out = 0;
+  uint32_t window_full = 0;
+  uint32_t pushes = 0;
+  uint32_t samples = 0;
+  // from when each request was due to be sent, so that the wait for a full window counts too
+  std::vector<uint64_t> round_trips_us;
+};
+
+void printUsage(const char *name)
+{
+  printf("Usage: %s [options]\n"
+         "  -H, --host HOST        mbed address (default 192.168.1.20; 127.0.0.1 for the simulator)\n"
+         "  -p, --port PORT        (default 5333)\n"
+         "  -u, --udp              use the UDP transport instead of TCP\n"
+         "  -r, --rate HZ          requests per second, 0 for as fast as the window allows (default 100)\n"
+         "  -d, --duration SEC     (default 10)\n"
+         "  -w, --window N         requests in flight at most; 1 waits for every answer (default 1)\n"
+         "                         round trips count from when a request was due, so a full window adds to them\n"
+         "  -t, --timeout MS       requests unanswered for this long count as lost (default 1000)\n"
+         "  -P, --push MS          also subscribe to push telemetry with this period\n"
+         "  -s, --speed M_S        send this speed to both wheels, which takes command; the wheels turn!\n"
+         "  -c, --clock-sync       synchronize the mbed with this host's clock\n",
+         name);
+}
+
+bool parseOptions(int argc, char **argv, Options &options)
+{
+  static const option long_options[] = {
+    { "host", required_argument, nullptr, 'H' },    { "port", required_argument, nullptr, 'p' },
+    { "udp", no_argument, nullptr, 'u' },           { "rate", required_argument, nullptr, 'r' },
+    { "duration", required_argument, nullptr, 'd' }, { "window", required_argument, nullptr, 'w' },
+    { "timeout", required_argument, nullptr, 't' }, { "push", required_argument, nullptr, 'P' },
+    { "speed", required_argument, nullptr, 's' },   { "clock-sync", no_argument, nullptr, 'c' },
+    { "help", no_argument, nullptr, 'h' },          { nullptr, 0, nullptr, 0 },
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "H:p:ur:d:w:t:P:s:ch", long_options, nullptr)) != -1)
+  {
+    switch (opt)
+    {
+      case 'H':
+        options.host = optarg;
+        break;
+      case 'p':
+        options.port = static_cast<uint16_t>(strtoul(optarg, nullptr, 10));
+        break;
+      case 'u':
+        options.transport = IgvcClient::Transport::UDP;
+        break;
+      case 'r':
+        options.rate_hz = strtod(optarg, nullptr);
+        break;
+      case 'd':
+        options.duration_sec = strtod(optarg, nullptr);
+        break;
+      case 'w':
+        options.window = static_cast<uint32_t>(strtoul(optarg, nullptr, 10));
+        break;
+      case 't':
+        options.timeout_ms = static_cast<uint32_t>(strtoul(optarg, nullptr, 10));
+        break;
+      case 'P':
+        options.push_period_ms = static_cast<uint32_t>(strtoul(optarg, nullptr, 10));
+        break;
+      case 's':
+        options.send_speed = true;
+        options.speed = strtof(optarg, nullptr);
+        break;
+      case 'c':
+        options.clock_sync = true;
+        break;
+      default:
+        return false;
+    }
+  }
+  return optind == argc && options.rate_hz >= 0.0 && options.duration_sec > 0.0 && options.window > 0;
+}
+
+/* Nearest rank percentile of sorted values */
+uint64_t percentile(const std::vector<uint64_t> &sorted, double fraction)
+{
+  if (sorted.empty())
+  {
+    return 0;
+  }
+  auto rank = static_cast<size_t>(fraction * static_cast<double>(sorted.size()) + 0.999999);
+  rank = std::max<size_t>(rank, 1);
+  return sorted[std::min(rank, sorted.size()) - 1];
+}
+
+void printReport(Stats &stats, double elapsed_sec)
+{
+  std::vector<uint64_t> &round_trips = stats.round_trips_us;
+  std::sort(round_trips.begin(), round_trips.end());
+  uint64_t sum_us = 0;
+  for (uint64_t round_trip : round_trips)
+  {
+    sum_us += round_trip;
+  }
+
+  printf("requests   %" PRIu32 " sent, %" PRIu32 " answered, %" PRIu32 " coalesced, %" PRIu32 " lost\n", stats.sent,
+         stats.answered, stats.coalesced, stats.timed_out);
+  printf("throughput %.1f requests/s, %.1f answers/s", stats.sent / elapsed_sec,
+         (stats.answered + stats.coalesced) / elapsed_sec);
+  if (stats.window_full > 0)
+  {
+    printf(", %" PRIu32 " sends delayed by a full window", stats.window_full);
+  }
+  printf("\n");
+  if (stats.pushes > 0)
+  {
+    printf("push       %.1f messages/s, %.1f samples/s\n", stats.pushes / elapsed_sec, stats.samples / elapsed_sec);
+  }
+  if (!round_trips.empty())
+  {
+    printf("round trip us: min %" PRIu64 "  mean %" PRIu64 "  p50 %" PRIu64 "  p90 %" PRIu64 "  p99 %" PRIu64
+           "  p99.9 %" PRIu64 "  max %" PRIu64 "\n",
+           round_trips.front(), sum_us / round_trips.size(), percentile(round_trips, 0.5),
+           percentile(round_trips, 0.9), percentile(round_trips, 0.99), percentile(round_trips, 0.999),
+           round_trips.back());
+  }
+}
+}  // namespace
+
+int main(int argc, char **argv)
+{
+  Options options;
+  if (!parseOptions(argc, argv, options))
+  {
+    printUsage(argv[0]);
+    return 2;
+  }
+
+  IgvcClient client;
+  if (!client.connect(options.host, options.port, options.transport))
+  {
+    fprintf(stderr, "%s\n", client.error().c_str());
+    return 1;
+  }
+  client.setTimeoutUs(options.timeout_ms * 1000ull);
+  client.setClockSync(options.clock_sync);
+
+  Stats stats;
+  stats.round_trips_us.reserve(static_cast<size_t>(options.rate_hz * options.duration_sec) + 1);
+  client.setTelemetryCallback([&stats](const ResponseMessage &response) {
+    if (!response.has_seq)
+    {
+      ++stats.pushes;
+      stats.samples += response.samples_count;
+    }
+  });
+
+  RequestMessage request = RequestMessage_init_zero;
+  request.has_speed_l = options.send_speed;
+  request.speed_l = options.speed;
+  request.has_speed_r = options.send_speed;
+  request.speed_r = options.speed;
+  if (options.push_period_ms > 0)
+  {
+    RequestMessage subscribe = RequestMessage_init_zero;
+    subscribe.has_push_period_ms = true;
+    subscribe.push_period_ms = options.push_period_ms;
+    client.send(subscribe);
+  }
+
+  const uint64_t period_us = options.rate_hz > 0.0 ? static_cast<uint64_t>(1e6 / options.rate_hz) : 0;
+  const uint64_t start_us = IgvcClient::nowUs();
+  const auto end_us = start_us + static_cast<uint64_t>(options.duration_sec * 1e6);
+  uint64_t next_send_us = start_us;
+  bool window_was_full = false;
+  uint64_t now_us = start_us;
+  while (now_us < end_us || (client.inFlight() > 0 && client.isConnected()))
+  {
+    if (now_us < end_us && now_us >= next_send_us)
+    {
+      if (client.inFlight() < options.window)
+      {
+        // Measured from the schedule, not from the actual send: a request held back by a full window, and
+        // the catch-up burst after it, would otherwise hide the very delays the load causes
+        const uint64_t scheduled_us = period_us > 0 ? next_send_us : now_us;
+        uint32_t seq = client.send(request, [&stats, scheduled_us](const IgvcClient::Reply &reply) {
+          if (reply.response == nullptr)
+          {
+            ++stats.timed_out;
+            return;
+          }
+          if (reply.response->seq == reply.seq)
+          {
+            ++stats.answered;
+          }
+          else
+          {
+            ++stats.coalesced;
+          }
+          stats.round_trips_us.push_back(reply.sent_us + reply.round_trip_us - scheduled_us);
+        });
+        if (seq == 0)
+        {
+          break;
+        }
+        ++stats.sent;
+        next_send_us = period_us > 0 ? next_send_us + period_us : now_us;
+        window_was_full = false;
+      }
+      else if (!window_was_full)
+      {
+        ++stats.window_full;
+        window_was_full = true;
+      }
+    }
+
+    // sleep until the next send is due, but spin for the last millisecond
+    int64_t wait_us = static_cast<int64_t>(next_send_us - now_us);
+    int timeout_ms = now_us >= end_us ? 10 : static_cast<int>(std::max<int64_t>(wait_us / 1000 - 1, 0));
+    if (!client.poll(client.inFlight() >= options.window ? 1 : timeout_ms))
+    {
+      break;
+    }
+    now_us = IgvcClient::nowUs();
+  }
+
+  double elapsed_sec = static_cast<double>(std::min(now_us, end_us) - start_us) / 1e6;
+  if (!client.isConnected())
+  {
+    fprintf(stderr, "%s\n", client.error().c_str());
+  }
+  printReport(stats, elapsed_sec);
+  return client.isConnected() ? 0 : 1;
+}
@@ -0,0 +1,67 @@
+#include "battery_monitor/battery_monitor.h"
+
+BatteryMonitor::BatteryMonitor(uint32_t full_scale_mv, uint32_t oversample, uint32_t filter_shift,
+                               uint32_t low_mv, uint32_t hysteresis_mv)
+  : full_scale_mv(full_scale_mv)
+  , oversample(oversample)
+  , filter_shift(filter_shift)
+  , low_mv(low_mv)
+  , hysteresis_mv(hysteresis_mv)
+{
+}
+
+void BatteryMonitor::addSample(uint16_t raw)
+{
+  block_sum += raw;
+  if (++block_samples < oversample)
+  {
+    return;
+  }
+  addBlock(block_sum);
+  block_sum = 0;
+  block_samples = 0;
+}
+
+void BatteryMonitor::addBlock(uint32_t sum)
+{
+  uint32_t input = sum << FILTER_FRAC_BITS;
+  if (!has_filtered)
+  {
+    filtered = input;
+    has_filtered = true;
+  }
+  else
+  {
+    auto step = static_cast<int32_t>(input - filtered) >> filter_shift;
+    filtered += step;
+  }
+
+  uint64_t full_scale = static_cast<uint64_t>(4095 * oversample) << FILTER_FRAC_BITS;
+  auto mv = static_cast<uint32_t>(static_cast<uint64_t>(filtered) * full_scale_mv / full_scale);
+  cached_mv = mv;
+
+  if (!low && mv < low_mv)
+  {
+    low = true;
+    low_events = low_events + 1;
+  }
+  else if (low && mv > low_mv + hysteresis_mv)
+  {
+    low = false;
+  }
+}
+
+uint32_t BatteryMonitor::millivolts() const
+{
+  return cached_mv;
+}
+
+bool BatteryMonitor::isLow() const
+{
+  return low;
+}
+
+uint32_t BatteryMonitor::lowEvents() const
+{
+  return low_events;
+}
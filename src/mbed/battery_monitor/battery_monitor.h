@@ -0,0 +1,60 @@
+#ifndef BATTERY_MONITOR_H
+#define BATTERY_MONITOR_H
+
+#include <cstdint>
+
+/**
+ * Filtered battery voltage from raw 12-bit ADC conversions.
+ *
+ * Every oversample conversions are summed into one block, which gains log2(oversample) / 2 bits of
+ * resolution on uncorrelated noise, and the blocks go through a first order IIR filter. The voltage is
+ * scaled once per block in integer math and cached, so reading it costs nothing. The battery turns low
+ * when the voltage drops below low_mv and only recovers once it is back above low_mv + hysteresis_mv, so
+ * the load sagging the voltage doesn't make it flap.
+ *
+ * addSample() is meant to be called from a single thread; the getters may be called from any thread.
+ */
+class BatteryMonitor
+{
+public:
+  /*
+  @param[in] full_scale_mv battery voltage of a full scale (4095) conversion
+  @param[in] oversample conversions per block, at most 2048 so that the filter state fits in 31 bits
+  @param[in] filter_shift the IIR filter moves 1 / 2^filter_shift of the way to each new block
+  @param[in] low_mv the battery is low below this voltage
+  @param[in] hysteresis_mv how far above low_mv it has to recover
+  */
+  BatteryMonitor(uint32_t full_scale_mv, uint32_t oversample, uint32_t filter_shift, uint32_t low_mv,
+                 uint32_t hysteresis_mv);
+
+  void addSample(uint16_t raw);
+
+  /* filtered voltage, 0 until the first block is complete */
+  uint32_t millivolts() const;
+  bool isLow() const;
+  /* how many times the battery turned low since boot */
+  uint32_t lowEvents() const;
+
+private:
+  /* fraction bits of the filter state */
+  static constexpr uint32_t FILTER_FRAC_BITS = 8;
+
+  void addBlock(uint32_t sum);
+
+  const uint32_t full_scale_mv;
+  const uint32_t oversample;
+  const uint32_t filter_shift;
+  const uint32_t low_mv;
+  const uint32_t hysteresis_mv;
+
+  uint32_t block_sum = 0;
+  uint32_t block_samples = 0;
+  bool has_filtered = false;
+  uint32_t filtered = 0;  // block sum, with FILTER_FRAC_BITS fraction bits
+
+  volatile uint32_t cached_mv = 0;
+  volatile bool low = false;
+  volatile uint32_t low_events = 0;
+};
+
+#endif  // BATTERY_MONITOR_H
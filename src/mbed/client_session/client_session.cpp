@@ -0,0 +1,92 @@
+#include "client_session/client_session.h"
+
+void ClientSession::open(hal::TCPSocket *socket, uint64_t now_us)
+{
+  tcp_socket = socket;
+  is_open = true;
+  first_response = true;
+  request_framer.reset();
+  telemetry_schedule.reset();
+  push_period_ms = 0;
+  last_active_us = now_us;
+  param_reply = ParamReply();
+  loop_timing = LoopTiming();
+}
+
+void ClientSession::close()
+{
+  if (tcp_socket != nullptr)
+  {
+    // sockets returned by accept() free themselves on close
+    tcp_socket->close();
+    tcp_socket = nullptr;
+  }
+  is_open = false;
+  push_period_ms = 0;
+}
+
+bool ClientSession::isOpen() const
+{
+  return is_open;
+}
+
+hal::TCPSocket *ClientSession::socket() const
+{
+  return tcp_socket;
+}
+
+RequestFramer &ClientSession::framer()
+{
+  return request_framer;
+}
+
+TelemetrySchedule &ClientSession::telemetry()
+{
+  return telemetry_schedule;
+}
+
+void ClientSession::touch(uint64_t now_us)
+{
+  last_active_us = now_us;
+}
+
+uint64_t ClientSession::idleUs(uint64_t now_us) const
+{
+  return now_us - last_active_us;
+}
+
+uint64_t ClientSession::lastActiveUs() const
+{
+  return last_active_us;
+}
+
+bool ClientSession::takeFirstResponse()
+{
+  bool first = first_response;
+  first_response = false;
+  return first;
+}
+
+void ClientSession::configure(const RequestMessage &request)
+{
+  telemetry_schedule.configure(request);
+  if (request.has_push_period_ms)
+  {
+    push_period_ms = request.push_period_ms;
+  }
+}
+
+uint32_t ClientSession::pushPeriodMs() const
+{
+  return push_period_ms;
+}
+
+ClientSession::ParamReply &ClientSession::paramReply()
+{
+  return param_reply;
+}
+
+LoopTiming &ClientSession::loopTiming()
+{
+  return loop_timing;
+}
@@ -0,0 +1,76 @@
+#ifndef CLIENT_SESSION_H
+#define CLIENT_SESSION_H
+
+#include <cstdint>
+
+#include "hal/hal.h"
+#include "igvc.pb.h"
+#include "request_framer/request_framer.h"
+#include "telemetry_schedule/telemetry_schedule.h"
+#include "utils.h"
+
+/**
+ * One client of the network loop: its connection, the framer of its request stream and its telemetry
+ * subscription.
+ *
+ * Several TCP clients can be connected at once. Which of them drives the motors is decided by the network
+ * loop (see g_commander in firmware.cpp), a session knows nothing about control. With UDP there is a
+ * single session without a socket.
+ */
+class ClientSession
+{
+public:
+  /* Outcome of the client's parameter requests, carried by the next response */
+  struct ParamReply
+  {
+    bool send_params = false;    // get_params was set
+    uint32_t rejected_mask = 0;  // bit (1 << ParamId) of every parameter that was refused
+    bool has_save = false;
+    ParamSaveResult save = ParamSaveResult_SAVE_OK;
+  };
+
+  /*
+  Must hold g_state_mutex, the control loop adds to loopTiming()
+  @param[in] socket the connection, nullptr for UDP
+  @param[in] now_us hal::readMicros(), the session counts as active from here on
+  */
+  void open(hal::TCPSocket *socket, uint64_t now_us);
+  /* Closes the socket, if any */
+  void close();
+  bool isOpen() const;
+
+  hal::TCPSocket *socket() const;
+  RequestFramer &framer();
+  TelemetrySchedule &telemetry();
+
+  /* Call whenever the client sent something */
+  void touch(uint64_t now_us);
+  uint64_t idleUs(uint64_t now_us) const;
+  /* When the client last sent something */
+  uint64_t lastActiveUs() const;
+
+  /* true once after open(), for what only the first response carries */
+  bool takeFirstResponse();
+
+  /* Applies the subscription part of a request: the telemetry groups and the push period */
+  void configure(const RequestMessage &request);
+  /* 0 when the client doesn't want pushes */
+  uint32_t pushPeriodMs() const;
+
+  ParamReply &paramReply();
+  /* Control loop periods since the client's last LOOP_TIMING report. Guarded by g_state_mutex */
+  LoopTiming &loopTiming();
+
+private:
+  hal::TCPSocket *tcp_socket = nullptr;
+  bool is_open = false;
+  bool first_response = false;
+  RequestFramer request_framer;
+  TelemetrySchedule telemetry_schedule;
+  uint32_t push_period_ms = 0;
+  uint64_t last_active_us = 0;
+  ParamReply param_reply;
+  LoopTiming loop_timing;
+};
+
+#endif  // CLIENT_SESSION_H
@@ -0,0 +1,102 @@
+#include "clock_sync/clock_sync.h"
+
+#include "utils.h"
+
+namespace
+{
+/* The minimum delay creeps up by 1 us per ms, so a route that got slower for good is accepted within a second */
+constexpr int MIN_DELAY_RELAX_SHIFT = 10;
+/* Loop gains: the share of an exchange's error taken into the offset, and into the drift */
+constexpr float OFFSET_GAIN = 0.25f;
+constexpr float DRIFT_GAIN = 0.03f;
+/* Two crystals are within a few tens of ppm of each other; anything beyond this is noise */
+constexpr float MAX_DRIFT_PPM = 500.0f;
+}  // namespace
+
+bool ClockSync::add(const Exchange &exchange)
+{
+  auto processing_us = static_cast<int64_t>(exchange.t2_us - exchange.t1_us);
+  auto delay_us = static_cast<int64_t>(exchange.t3_us - exchange.t0_us) - processing_us;
+  if (processing_us < 0 || delay_us < 0)
+  {
+    return false;
+  }
+
+  if (!has_min_delay || delay_us < min_delay_us)
+  {
+    min_delay_us = delay_us;
+    has_min_delay = true;
+  }
+  else
+  {
+    min_delay_us += static_cast<int64_t>((exchange.t1_us - last_exchange_us) >> MIN_DELAY_RELAX_SHIFT);
+    min_delay_us = delay_us < min_delay_us ? delay_us : min_delay_us;
+  }
+  last_exchange_us = exchange.t1_us;
+  if (delay_us > min_delay_us + CLOCK_SYNC_MAX_EXTRA_DELAY_US)
+  {
+    return false;
+  }
+
+  // the mbed's time of the exchange is the middle of its processing, where both legs of the trip meet
+  uint64_t mbed_us = exchange.t1_us + static_cast<uint64_t>(processing_us / 2);
+  uint64_t measured_us = exchange.t1_us - exchange.t0_us - static_cast<uint64_t>(delay_us / 2);
+  last_delay_us = delay_us > INT32_MAX ? INT32_MAX : static_cast<int32_t>(delay_us);
+
+  int64_t error_us = static_cast<int64_t>(measured_us - static_cast<uint64_t>(offsetUs(mbed_us)));
+  auto elapsed_us = static_cast<int64_t>(mbed_us - reference_us);
+  if (!is_synced || elapsed_us <= 0 || error_us > CLOCK_SYNC_STEP_US || error_us < -CLOCK_SYNC_STEP_US)
+  {
+    // first exchange, or one of the clocks was set: start over from this one
+    is_synced = true;
+    reference_us = mbed_us;
+    offset_us = measured_us;
+    drift_ppm = 0.0f;
+    return true;
+  }
+
+  auto correction_us = static_cast<int64_t>(OFFSET_GAIN * static_cast<float>(error_us));
+  offset_us = static_cast<uint64_t>(offsetUs(mbed_us)) + static_cast<uint64_t>(correction_us);
+  reference_us = mbed_us;
+  drift_ppm += DRIFT_GAIN * static_cast<float>(error_us) * 1e6f / static_cast<float>(elapsed_us);
+  drift_ppm = drift_ppm > MAX_DRIFT_PPM ? MAX_DRIFT_PPM : (drift_ppm < -MAX_DRIFT_PPM ? -MAX_DRIFT_PPM : drift_ppm);
+  return true;
+}
+
+void ClockSync::reset()
+{
+  *this = ClockSync();
+}
+
+bool ClockSync::synced() const
+{
+  return is_synced;
+}
+
+uint64_t ClockSync::toHostTime(uint64_t mbed_us) const
+{
+  return mbed_us - static_cast<uint64_t>(offsetUs(mbed_us));
+}
+
+uint64_t ClockSync::toMbedTime(uint64_t host_us) const
+{
+  // the offset hardly changes over the difference of the clocks, so it is taken where host_us roughly is
+  return host_us + static_cast<uint64_t>(offsetUs(host_us + offset_us));
+}
+
+int64_t ClockSync::offsetUs(uint64_t mbed_us) const
+{
+  auto elapsed_us = static_cast<float>(static_cast<int64_t>(mbed_us - reference_us));
+  auto drifted_us = static_cast<int64_t>(drift_ppm * 1e-6f * elapsed_us);
+  return static_cast<int64_t>(offset_us + static_cast<uint64_t>(drifted_us));
+}
+
+float ClockSync::driftPpm() const
+{
+  return drift_ppm;
+}
+
+int32_t ClockSync::lastDelayUs() const
+{
+  return last_delay_us;
+}
@@ -0,0 +1,59 @@
+#ifndef CLOCK_SYNC_H
+#define CLOCK_SYNC_H
+
+#include <cstdint>
+
+/**
+ * Estimate of the host's clock from NTP-style exchanges (see RequestMessage.clock_sync).
+ *
+ * The host sends a request at t0 on its clock, the mbed receives it at t1 and answers at t2 on its own, and
+ * the answer arrives at t3. With the same delay both ways, the clocks differ by (t1 - t0) - delay / 2, where
+ * delay = (t3 - t0) - (t2 - t1) is the round trip minus the time spent on the mbed. Delay the two ways don't
+ * share shows up as error, so only exchanges close to the fastest recent one are used, like NTP's clock
+ * filter. The offset is then followed by a second order loop that also learns how fast the clocks drift
+ * apart, so the estimate holds between exchanges.
+ *
+ * Only used by the network thread.
+ */
+class ClockSync
+{
+public:
+  /* One exchange, all four times in microseconds */
+  struct Exchange
+  {
+    uint64_t t0_us;  // host clock, request sent
+    uint64_t t1_us;  // mbed clock, request received
+    uint64_t t2_us;  // mbed clock, answer sent
+    uint64_t t3_us;  // host clock, answer received
+  };
+
+  /* @return whether the exchange was used; ones delayed much more than the fastest recent one are not */
+  bool add(const Exchange &exchange);
+  /* Forgets the host, e.g. when another one takes command */
+  void reset();
+
+  bool synced() const;
+  /* Conversions between the clocks, meaningful once synced() */
+  uint64_t toHostTime(uint64_t mbed_us) const;
+  uint64_t toMbedTime(uint64_t host_us) const;
+
+  /* mbed clock - host clock at mbed_us */
+  int64_t offsetUs(uint64_t mbed_us) const;
+  /* How much faster the mbed clock runs, in parts per million */
+  float driftPpm() const;
+  /* Delay of the last exchange used */
+  int32_t lastDelayUs() const;
+
+private:
+  bool is_synced = false;
+  uint64_t reference_us = 0;  // mbed clock of the last exchange used
+  uint64_t offset_us = 0;     // offset at reference_us, modulo 2^64 as the clocks have unrelated origins
+  float drift_ppm = 0.0f;
+  int32_t last_delay_us = 0;
+
+  bool has_min_delay = false;
+  int64_t min_delay_us = 0;
+  uint64_t last_exchange_us = 0;
+};
+
+#endif  // CLOCK_SYNC_H
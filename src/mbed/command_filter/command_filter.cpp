@@ -0,0 +1,73 @@
+#include "command_filter/command_filter.h"
+
+namespace
+{
+/* The minimum offset creeps up by 1 us every 8192 us (~120 ppm), more than two crystals drift apart */
+constexpr int RELAX_SHIFT = 13;
+}  // namespace
+
+CommandFilter::CommandFilter(int32_t max_delay_us, int32_t resync_us)
+  : max_delay_us(max_delay_us), resync_us(resync_us)
+{
+}
+
+CommandFilter::Verdict CommandFilter::check(const RequestMessage &request, uint64_t now_us)
+{
+  if ((has_seq || has_offset) && now_us - last_accept_us > static_cast<uint64_t>(resync_us))
+  {
+    reset();
+  }
+
+  last_delay_us = 0;
+  if (request.has_host_time_us)
+  {
+    // the clocks have unrelated origins, so the offset is taken modulo 2^64
+    uint64_t offset_us = now_us - request.host_time_us;
+    if (!has_offset)
+    {
+      min_offset_us = offset_us;
+      has_offset = true;
+    }
+    else
+    {
+      min_offset_us += (now_us - last_check_us) >> RELAX_SHIFT;
+    }
+    last_check_us = now_us;
+
+    auto delay_us = static_cast<int64_t>(offset_us - min_offset_us);
+    if (delay_us < 0)
+    {
+      min_offset_us = offset_us;
+      delay_us = 0;
+    }
+    last_delay_us = delay_us > INT32_MAX ? INT32_MAX : static_cast<int32_t>(delay_us);
+  }
+
+  if (request.has_seq && has_seq && static_cast<int32_t>(request.seq - last_seq) <= 0)
+  {
+    return Verdict::OUT_OF_ORDER;
+  }
+  if (last_delay_us > max_delay_us)
+  {
+    return Verdict::LATE;
+  }
+
+  if (request.has_seq)
+  {
+    has_seq = true;
+    last_seq = request.seq;
+  }
+  last_accept_us = now_us;
+  return Verdict::ACCEPT;
+}
+
+void CommandFilter::reset()
+{
+  has_seq = false;
+  has_offset = false;
+}
+
+int32_t CommandFilter::lastDelay() const
+{
+  return last_delay_us;
+}
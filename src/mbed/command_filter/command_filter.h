@@ -0,0 +1,58 @@
+#ifndef COMMAND_FILTER_H
+#define COMMAND_FILTER_H
+
+#include <cstdint>
+
+#include "igvc.pb.h"
+
+/**
+ * Decides whether a request that arrived over UDP should still be applied.
+ *
+ * Datagrams can be reordered or delayed on a congested network. A request is dropped when its seq is
+ * not newer than the last accepted one, or when it arrived late. The clocks of the host and the mbed
+ * are not synchronized, so lateness is measured relative to the fastest request seen: the smallest
+ * (arrival - host_time_us) offset is taken as zero delay, and every other request's delay is its offset
+ * minus that minimum. The minimum is slowly relaxed so that clock drift is not mistaken for delay.
+ */
+class CommandFilter
+{
+public:
+  enum class Verdict
+  {
+    ACCEPT,
+    OUT_OF_ORDER,
+    LATE
+  };
+
+  /*
+  @param[in] max_delay_us requests delayed by more than this are LATE
+  @param[in] resync_us after this long without an accepted request, the next one is always accepted,
+  so that a restarted host (whose seq starts over) is picked up again
+  */
+  CommandFilter(int32_t max_delay_us, int32_t resync_us);
+
+  /*
+  Requests without seq or host_time_us skip the corresponding check.
+  @param[in] now_us hal::readMicros() when the request arrived
+  */
+  Verdict check(const RequestMessage &request, uint64_t now_us);
+  void reset();
+
+  /* delay of the last checked request, in us */
+  int32_t lastDelay() const;
+
+private:
+  const int32_t max_delay_us;
+  const int32_t resync_us;
+
+  bool has_seq = false;
+  uint32_t last_seq = 0;
+  uint64_t last_accept_us = 0;
+
+  bool has_offset = false;
+  uint64_t min_offset_us = 0;
+  uint64_t last_check_us = 0;
+  int32_t last_delay_us = 0;
+};
+
+#endif  // COMMAND_FILTER_H
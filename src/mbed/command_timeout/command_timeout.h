@@ -0,0 +1,102 @@
+#ifndef COMMAND_TIMEOUT_H
+#define COMMAND_TIMEOUT_H
+
+#include <cstdint>
+
+#include "pid_kernel/pid_kernel.h"
+#include "utils.h"
+
+/**
+ * Failsafe against a host that stops sending setpoints while its connection stays up. It is evaluated by
+ * the control loop itself, so it works whatever the network thread is doing.
+ *
+ * Once the last setpoint is older than the timeout, both setpoints are ramped down to zero at a fixed
+ * deceleration, scaled together so that the robot keeps its curvature while it stops. The loop notices a
+ * stale setpoint at most one control period late; how late is measured on every trip.
+ */
+template <typename T>
+class CommandTimeout
+{
+public:
+  /*
+  @param[in] timeout_us age at which a setpoint is stale
+  @param[in] decel deceleration of the ramp in m/s^2
+  */
+  CommandTimeout(int32_t timeout_us, float decel) : timeout_us(timeout_us), decel(T(decel))
+  {
+  }
+
+  void setTimeout(int32_t timeout)
+  {
+    timeout_us = timeout;
+  }
+
+  /* A fresh setpoint was applied */
+  void commandReceived(uint64_t now_us)
+  {
+    last_command_us = now_us;
+    has_command = true;
+    is_tripped = false;
+  }
+
+  /*
+  Call once per control period, before the setpoints are used.
+  @return whether the setpoints are stale, i.e. being ramped down
+  */
+  bool update(uint64_t now_us, const ControlTiming<T> &timing, T &desired_l, T &desired_r)
+  {
+    auto late_us = static_cast<int64_t>(now_us - last_command_us) - timeout_us;
+    if (!has_command || late_us <= 0)
+    {
+      return false;
+    }
+    if (!is_tripped)
+    {
+      is_tripped = true;
+      ++trip_count;
+      last_latency_us = static_cast<int32_t>(late_us);
+    }
+
+    T largest = absolute(desired_l) > absolute(desired_r) ? absolute(desired_l) : absolute(desired_r);
+    T step = decel * timing.d_t_sec;
+    if (largest <= step)
+    {
+      desired_l = T();
+      desired_r = T();
+    }
+    else
+    {
+      T scale = (largest - step) / largest;
+      desired_l = desired_l * scale;
+      desired_r = desired_r * scale;
+    }
+    return true;
+  }
+
+  bool tripped() const
+  {
+    return is_tripped;
+  }
+
+  uint32_t trips() const
+  {
+    return trip_count;
+  }
+
+  /* How long after going stale the last stale setpoint was noticed */
+  int32_t lastLatencyUs() const
+  {
+    return last_latency_us;
+  }
+
+private:
+  int32_t timeout_us;
+  const T decel;
+  uint64_t last_command_us = 0;
+  bool has_command = false;
+  bool is_tripped = false;
+  uint32_t trip_count = 0;
+  int32_t last_latency_us = 0;
+};
+
+#endif  // COMMAND_TIMEOUT_H
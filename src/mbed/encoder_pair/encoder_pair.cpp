@@ -1,6 +1,5 @@
 
 #include "encoder_pair.h"
-#include "mbed.h"
 
 EncoderPair::EncoderPair():
     left_encoder_a(p24),
@@ -8,10 +7,16 @@ EncoderPair::EncoderPair():
     right_encoder_a(p26),
     right_encoder_b(p25),
     left_tick_count(0),
-    right_tick_count(0)
+    right_tick_count(0),
+    left_reverse_count(0),
+    right_reverse_count(0),
+    left_forward_total(0),
+    left_reverse_total(0),
+    right_forward_total(0),
+    right_reverse_total(0)
 {
-  left_encoder_a.rise(callback(this, &EncoderPair::tickLeft));
-  right_encoder_a.rise(callback(this, &EncoderPair::tickRight));
+  left_encoder_a.rise(hal::callback(this, &EncoderPair::tickLeft));
+  right_encoder_a.rise(hal::callback(this, &EncoderPair::tickRight));
 }
 
 EncoderPair::EncoderPair(bool double_ticks):
@@ -20,51 +25,100 @@ EncoderPair::EncoderPair(bool double_ticks):
     right_encoder_a(p26),
     right_encoder_b(p25),
     left_tick_count(0),
-    right_tick_count(0)
+    right_tick_count(0),
+    left_reverse_count(0),
+    right_reverse_count(0),
+    left_forward_total(0),
+    left_reverse_total(0),
+    right_forward_total(0),
+    right_reverse_total(0)
 {
-  left_encoder_a.rise(callback(this, &EncoderPair::tickLeft));
-  right_encoder_a.rise(callback(this, &EncoderPair::tickRight));
+  left_encoder_a.rise(hal::callback(this, &EncoderPair::tickLeft));
+  right_encoder_a.rise(hal::callback(this, &EncoderPair::tickRight));
   if (double_ticks)
   {
-    left_encoder_a.fall(callback(this, &EncoderPair::tickLeft));
-    right_encoder_a.fall(callback(this, &EncoderPair::tickRight));
+    left_encoder_a.fall(hal::callback(this, &EncoderPair::tickLeft));
+    right_encoder_a.fall(hal::callback(this, &EncoderPair::tickRight));
   }
 }
 
 void EncoderPair::tickLeft()
 {
+  uint64_t now_us = hal::readMicros();
   if (left_encoder_a.read() == left_encoder_b.read())
   {
     ++left_tick_count;
+    left_edges.push({ now_us, 1 });
   }
   else
   {
     --left_tick_count;
+    ++left_reverse_count;
+    left_edges.push({ now_us, -1 });
   }
 }
 
 void EncoderPair::tickRight()
 {
+  uint64_t now_us = hal::readMicros();
   if (right_encoder_a.read() == right_encoder_b.read())
   {
     ++right_tick_count;
+    right_edges.push({ now_us, 1 });
   }
   else
   {
     --right_tick_count;
+    ++right_reverse_count;
+    right_edges.push({ now_us, -1 });
   }
 }
 
-int EncoderPair::getLeftTicks()
+EncoderSnapshot EncoderPair::snapshot()
 {
-  int tick_count = left_tick_count;
-  left_tick_count = 0;
-  return tick_count;
+  EncoderSnapshot snapshot{};
+  int left_reverse;
+  int right_reverse;
+  {
+    // the encoder ISRs must not run between reading and clearing the counters
+    hal::CriticalSectionLock lock;
+    snapshot.time_us = hal::readMicros();
+    snapshot.left_ticks = left_tick_count;
+    snapshot.right_ticks = right_tick_count;
+    left_reverse = left_reverse_count;
+    right_reverse = right_reverse_count;
+    left_tick_count = 0;
+    right_tick_count = 0;
+    left_reverse_count = 0;
+    right_reverse_count = 0;
+  }
+  // net = forward - reverse
+  left_forward_total += static_cast<uint64_t>(snapshot.left_ticks + left_reverse);
+  left_reverse_total += static_cast<uint64_t>(left_reverse);
+  right_forward_total += static_cast<uint64_t>(snapshot.right_ticks + right_reverse);
+  right_reverse_total += static_cast<uint64_t>(right_reverse);
+  snapshot.left_forward_total = left_forward_total;
+  snapshot.left_reverse_total = left_reverse_total;
+  snapshot.right_forward_total = right_forward_total;
+  snapshot.right_reverse_total = right_reverse_total;
+  return snapshot;
+}
+
+bool EncoderPair::popLeftEdge(EncoderEdge &edge, uint64_t until_us)
+{
+  return popEdge(left_edges, edge, until_us);
 }
 
-int EncoderPair::getRightTicks()
+bool EncoderPair::popRightEdge(EncoderEdge &edge, uint64_t until_us)
 {
-  int tick_count = right_tick_count;
-  right_tick_count = 0;
-  return tick_count;
+  return popEdge(right_edges, edge, until_us);
+}
+
+bool EncoderPair::popEdge(SpscRing<EncoderEdge, EDGE_RING_SIZE> &edges, EncoderEdge &edge, uint64_t until_us)
+{
+  if (!edges.peek(edge) || edge.time_us > until_us)
+  {
+    return false;
+  }
+  return edges.pop(edge);
 }
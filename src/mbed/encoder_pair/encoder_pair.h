@@ -2,25 +2,64 @@
 #ifndef ENCODER_PAIR_H
 #define ENCODER_PAIR_H
 
-#include "mbed.h"
+#include "hal/hal.h"
+#include "spsc_ring/spsc_ring.h"
+
+/* One encoder tick, timestamped by the ISR */
+struct EncoderEdge
+{
+  uint64_t time_us;
+  int32_t direction;  // +1 or -1
+};
+
+/* Both wheels latched at the same instant */
+struct EncoderSnapshot
+{
+  uint64_t time_us;     // hal::readMicros() when the counts were latched
+  int32_t left_ticks;   // net ticks since the previous snapshot
+  int32_t right_ticks;
+  // ticks since boot, forward and backward counted apart so that each total only ever increases
+  uint64_t left_forward_total;
+  uint64_t left_reverse_total;
+  uint64_t right_forward_total;
+  uint64_t right_reverse_total;
+};
 
 class EncoderPair
 {
 public:
+  /* Edges the control loop has not consumed yet; at 1.5 m/s and 5 ms there are ~10 per period */
+  static constexpr uint32_t EDGE_RING_SIZE = 64;
+
   EncoderPair();
   explicit EncoderPair(bool double_ticks);
-  int getLeftTicks();
-  int getRightTicks();
+  /* Atomically latches and clears both tick counters */
+  EncoderSnapshot snapshot();
+  /*
+  Consumer side of the edge rings, only call from one thread. Only returns edges timestamped at or
+  before until_us, so that the edges consumed match a snapshot.
+  */
+  bool popLeftEdge(EncoderEdge &edge, uint64_t until_us);
+  bool popRightEdge(EncoderEdge &edge, uint64_t until_us);
 
 private:
-  InterruptIn left_encoder_a;
-  DigitalIn left_encoder_b;
-  InterruptIn right_encoder_a;
-  DigitalIn right_encoder_b;
+  hal::InterruptIn left_encoder_a;
+  hal::DigitalIn left_encoder_b;
+  hal::InterruptIn right_encoder_a;
+  hal::DigitalIn right_encoder_b;
   volatile int left_tick_count;
   volatile int right_tick_count;
+  volatile int left_reverse_count;  // the backward ones among the ticks counted
+  volatile int right_reverse_count;
+  uint64_t left_forward_total;
+  uint64_t left_reverse_total;
+  uint64_t right_forward_total;
+  uint64_t right_reverse_total;
+  SpscRing<EncoderEdge, EDGE_RING_SIZE> left_edges;
+  SpscRing<EncoderEdge, EDGE_RING_SIZE> right_edges;
   void tickLeft();
   void tickRight();
+  static bool popEdge(SpscRing<EncoderEdge, EDGE_RING_SIZE> &edges, EncoderEdge &edge, uint64_t until_us);
 };
 
 
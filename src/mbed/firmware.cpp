@@ -0,0 +1,1496 @@
+#include "firmware.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string>
+
+#include <pb_decode.h>
+#include <pb_encode.h>
+#include "igvc.pb.h"
+#include "battery_monitor/battery_monitor.h"
+#include "client_session/client_session.h"
+#include "clock_sync/clock_sync.h"
+#include "command_filter/command_filter.h"
+#include "command_timeout/command_timeout.h"
+#include "encoder_pair/encoder_pair.h"
+#include "hal/hal.h"
+#include "odometry/odometry.h"
+#include "param_registry/param_registry.h"
+#include "param_store/param_store.h"
+#include "pid_kernel/pid_benchmark.h"
+#include "pid_kernel/pid_kernel.h"
+#include "request_framer/request_framer.h"
+#include "velocity_estimator/velocity_estimator.h"
+#include "sabertooth_controller/sabertooth_controller.h"
+#include "setpoint_queue/setpoint_queue.h"
+#include "stage_profiler/stage_profiler.h"
+#include "system_identifier/system_identifier.h"
+#include "telemetry_schedule/telemetry_schedule.h"
+#include "tick_recorder/tick_recorder.h"
+#include "twist_limiter/twist_limiter.h"
+#include "wheel_controller/wheel_controller.h"
+#include "utils.h"
+
+/* hardware definitions */
+hal::Ticker g_control_ticker;
+EncoderPair encoders;
+/* The response being built; only the network thread touches these */
+ResponseMessage g_response;
+uint8_t g_response_buffer[RESPONSE_BUFFER_SIZE];
+/* A UDP datagram being decoded; too large for the network thread's stack */
+uint8_t g_request_buffer[REQUEST_BUFFER_SIZE];
+/* Push telemetry ring. It lives in AHB SRAM bank 0 (0x2007C000, 16 KB), which mbed leaves to USB that we
+ * don't use; bank 1 holds the EMAC buffers. The section is NOLOAD, see TickRecorder::init() */
+TickRecorder g_tick_recorder __attribute__((section("AHBSRAM0")));
+static_assert(sizeof(TickRecorder) <= 16 * 1024, "TickRecorder must fit in AHBSRAM0");
+SaberToothController g_motor_controller(p13, SABERTOOTH_BAUD, SABERTOOTH_KEEPALIVE_MS);
+
+/* mbed pin definitions */
+hal::DigitalOut g_mbed_led1(LED1);
+hal::DigitalOut g_mbed_led2(LED2);
+hal::DigitalOut g_mbed_led3(LED3);
+hal::DigitalOut g_mbed_led4(LED4);
+hal::DigitalOut g_board_led(p8);
+hal::DigitalOut g_safety_light_enable(p11);
+hal::InterruptIn g_e_stop_status(p15);
+// only sets up the pin, the ADC then runs in burst mode, see sampleBattery()
+hal::AnalogIn g_battery(p19);
+BatteryMonitor g_battery_monitor(BATTERY_FULL_SCALE_MV, BATTERY_OVERSAMPLE, BATTERY_FILTER_SHIFT, BATTERY_LOW_MV,
+                                 BATTERY_HYSTERESIS_MV);
+
+/* network loop. Only the network thread touches these */
+hal::EventQueue g_network_queue(NETWORK_QUEUE_EVENTS * EVENTS_EVENT_SIZE);
+hal::TCPSocket g_server_socket;
+// set while serviceSockets() is queued, so that a burst of socket events queues it only once
+std::atomic<bool> g_network_event_pending{ false };
+// with UDP only the first session is used
+ClientSession g_sessions[MAX_SESSIONS];
+// the session whose requests drive the motors, nullptr while nobody is in command
+ClientSession *g_commander = nullptr;
+// The session whose diagnostics reports start a new window of the stage statistics, see fillResponse()
+ClientSession *g_diagnostics_reader = nullptr;
+// the commander's clock, see RequestMessage.clock_sync
+ClockSync g_clock_sync;
+// mbed clock when the commander's last setpoints were applied, 0 before the first
+uint64_t g_command_applied_us = 0;
+
+/* Cycle counts of the stages of the main loop and the control loop */
+StageProfiler g_profiler;
+
+/* control loop threading */
+hal::Thread g_control_thread(osPriorityRealtime, CONTROL_THREAD_STACK_SIZE);
+// Guards all control state shared between the control thread and the network thread
+hal::Mutex g_state_mutex;
+int32_t g_last_period_us = 0;
+
+/* PID calculation values */
+uint64_t g_last_loop_us = 0;
+WheelController<ControlScalar> g_controller_l;
+WheelController<ControlScalar> g_controller_r;
+VelocityEstimator<ControlScalar> g_velocity_l;
+VelocityEstimator<ControlScalar> g_velocity_r;
+EncoderSnapshot g_encoder_snapshot{};
+Odometry g_odometry(WHEEL_BASE);
+
+/* Motor Data (see utils.h) */
+MotorCoeffs g_motor_coeffs;
+MotorStatusPair g_motor_pair;
+// Setpoints queued ahead by the host; while active it writes g_motor_pair's desired speeds
+SetpointQueue<ControlScalar> g_setpoint_queue;
+// Body velocity setpoints; while active it writes g_motor_pair's desired speeds
+TwistLimiter<ControlScalar> g_twist_limiter;
+// Drives the motors instead of the controllers while it runs, see RequestMessage.sysid
+SystemIdentifier g_sysid;
+
+/* Tunable parameters and their copy in flash. g_params is guarded by g_state_mutex */
+ParamRegistry g_params;
+ParamStore g_param_store;
+ParamSource g_param_source = ParamSource_PARAMS_DEFAULTS;
+
+/* e-stop logic */
+int g_estop = 1;
+CommandTimeout<ControlScalar> g_command_timeout(COMMAND_TIMEOUT_MS * 1000, COMMAND_TIMEOUT_DECEL);
+hal::ResetReason g_reset_reason = hal::ResetReason::UNKNOWN;
+
+/* function prototypes */
+int serveTcp(hal::EthernetInterface &net, hal::Serial &pc);
+int serveUdp(hal::EthernetInterface &net, hal::Serial &pc);
+void onNetworkEvent();
+void serviceSockets();
+void acceptClients();
+bool serviceSession(ClientSession &session);
+void pollSessions();
+void closeSession(ClientSession &session);
+void releaseCommand();
+void applyRequest(ClientSession &session, const RequestMessage &request);
+bool isCommand(const RequestMessage &request);
+void updatePushPeriod();
+void parseRequest(const RequestMessage &req, ClientSession::ParamReply &reply);
+void setParam(const Param &param, ClientSession::ParamReply &reply);
+void refuseParams(const RequestMessage &req, ClientSession::ParamReply &reply);
+void applyParams();
+ParamSaveResult saveParams();
+void pollEstop();
+void fillResponse(const RequestMessage &request, ClientSession &session);
+void fillDiagnostics(Diagnostics &diagnostics);
+void fillParams(ResponseMessage &response, ClientSession::ParamReply &reply);
+ResetReason toResetReason(hal::ResetReason reason);
+void fillClock(ResponseMessage &response);
+size_t encodeResponse(ResponseMessage &response, uint8_t *buffer, size_t size, bool delimited);
+bool sendResponse(ClientSession &session);
+bool sendResponse(hal::UDPSocket &socket, const hal::SocketAddress &host);
+template <typename Send>
+void pushTelemetry(Send send);
+void pid();
+void driveMotors(uint64_t time_us, int left_signal, int right_signal);
+void triggerEstop();
+void onEstopPressed();
+void controlTick();
+void controlLoop();
+void sampleBattery();
+
+int runFirmware()
+{
+  //    /* Read PCON register */
+  //  printf("PCON: 0x%x\n", *((unsigned int *)0x400FC180));
+  //  *(unsigned int *)0x400fc180 |= 0xf;
+
+  hal::Serial pc(USBTX, USBRX);
+  g_reset_reason = hal::readResetReason();
+  if (g_reset_reason == hal::ResetReason::WATCHDOG)
+  {
+    pc.printf("Reset by the watchdog!\r\n");
+  }
+
+  /* Boot into the last saved parameters, so the robot can drive before the host sends any gains */
+  if (!g_param_store.init())
+  {
+    pc.printf("Couldn't open the parameter store, using the defaults\r\n");
+  }
+  else if (ParamStore::Result result = g_param_store.load(g_params); result == ParamStore::Result::OK)
+  {
+    g_param_source = ParamSource_PARAMS_FLASH;
+    pc.printf("Loaded the saved parameters\r\n");
+  }
+  else if (result == ParamStore::Result::ERROR)
+  {
+    pc.printf("Saved parameters are invalid, using the defaults\r\n");
+  }
+  applyParams();
+  /* Open the server (mbed) via the EthernetInterface class */
+  if (BENCHMARK_PID)
+  {
+    benchmarkControllers(pc);
+  }
+
+  pc.printf("Connecting...\r\n");
+  hal::EthernetInterface net;
+
+  if (int ret = net.set_network(MBED_IP, NETMASK, COMPUTER_IP); ret != 0)
+  {
+    pc.printf("Error performing set_network(). Error code: %i\r\n", ret);
+    return 1;
+  }
+  if (int ret = net.connect(); ret != 0)
+  {
+    pc.printf("Error performing connect(). Error code: %i\r\n", ret);
+    return 1;
+  }
+
+  const char *ip = net.get_ip_address();
+  pc.printf("MBED's IP address is: %s\n", ip ? ip : "No IP");
+
+  g_last_loop_us = hal::readMicros();
+  g_tick_recorder.init();
+  hal::enableCycleCounter();
+
+  /* The velocity loop runs on its own high priority thread, woken by the ticker at a fixed rate.
+   * This (lower priority) main thread only handles the network. */
+  hal::startAdcBurst(p19);
+  g_control_thread.start(controlLoop);
+  g_control_ticker.attach_us(controlTick, CONTROL_PERIOD_US);
+  // the switch pulls p15 low when pressed
+  g_e_stop_status.fall(onEstopPressed);
+  // fed by the control loop, so it resets the chip when the loop stalls
+  hal::startWatchdog(WATCHDOG_TIMEOUT_MS);
+
+  if (TRANSPORT == Transport::UDP)
+  {
+    return serveUdp(net, pc);
+  }
+  return serveTcp(net, pc);
+}
+
+int serveTcp(hal::EthernetInterface &net, hal::Serial &pc)
+{
+  /* Instantiate a TCP Socket to function as the server and bind it to the
+   * specified port */
+  hal::TCPSocket &server_socket = g_server_socket;
+  if (int ret = server_socket.open(&net); ret != 0)
+  {
+    pc.printf("Error opening TCPSocket. Error code: %i\r\n", ret);
+    return 1;
+  }
+
+  if (int ret = server_socket.bind(MBED_IP, SERVER_PORT); ret != 0)
+  {
+    pc.printf("Error binding TCPSocket. Error code: %i\r\n", ret);
+    return 1;
+  }
+
+  if (int ret = server_socket.listen(MAX_SESSIONS); ret != 0)
+  {
+    pc.printf("Error listening. Error code: %i\r\n", ret);
+    return 1;
+  }
+
+  /* No socket call below blocks, so a client that went silent can't stall the others. The network stack
+   * reports activity on any socket through sigio, which queues serviceSockets() on this thread.
+   * pollSessions() runs every NETWORK_POLL_MS to push telemetry and to evict dead clients. */
+  server_socket.set_blocking(false);
+  server_socket.sigio(onNetworkEvent);
+  g_network_queue.call_every(NETWORK_POLL_MS, pollSessions);
+
+  g_mbed_led2 = 1;
+  pc.printf("Waiting for new connections...\r\n");
+  g_network_queue.dispatch_forever();
+  return 0;
+}
+
+/* sigio handler of every TCP socket. Runs on the network stack's thread, so it only queues the work */
+void onNetworkEvent()
+{
+  if (!g_network_event_pending.exchange(true) && g_network_queue.call(serviceSockets) == 0)
+  {
+    g_network_event_pending = false;
+  }
+}
+
+/* Accepts new clients and handles the requests of every connected one */
+void serviceSockets()
+{
+  // cleared first, so that an event arriving from here on queues another pass
+  g_network_event_pending = false;
+  acceptClients();
+  for (ClientSession &session : g_sessions)
+  {
+    if (session.isOpen() && !serviceSession(session))
+    {
+      closeSession(session);
+    }
+  }
+}
+
+void acceptClients()
+{
+  while (true)
+  {
+    int error = 0;
+    hal::TCPSocket *client = g_server_socket.accept(&error);
+    if (client == nullptr)
+    {
+      if (error != NSAPI_ERROR_WOULD_BLOCK)
+      {
+        printf("Error accepting. Error code: %i\r\n", error);
+      }
+      return;
+    }
+
+    hal::SocketAddress socket_address;
+    client->getpeername(&socket_address);
+    ClientSession *session = std::find_if(std::begin(g_sessions), std::end(g_sessions),
+                                          [](const ClientSession &s) { return !s.isOpen(); });
+    if (session == std::end(g_sessions))
+    {
+      printf("Rejected client from %s, all %i sessions are in use\r\n", socket_address.get_ip_address(),
+             MAX_SESSIONS);
+      client->close();
+      continue;
+    }
+
+    /* keepalive drops clients whose host died while they only listen to pushes */
+    const int keepalive = 1;
+    const int keepalive_idle_ms = TCP_KEEPALIVE_IDLE_MS;
+    const int keepalive_interval_ms = TCP_KEEPALIVE_INTERVAL_MS;
+    client->setsockopt(NSAPI_SOCKET, NSAPI_KEEPALIVE, &keepalive, sizeof(keepalive));
+    client->setsockopt(NSAPI_SOCKET, NSAPI_KEEPIDLE, &keepalive_idle_ms, sizeof(keepalive_idle_ms));
+    client->setsockopt(NSAPI_SOCKET, NSAPI_KEEPINTVL, &keepalive_interval_ms, sizeof(keepalive_interval_ms));
+    client->set_blocking(false);
+    client->sigio(onNetworkEvent);
+    g_state_mutex.lock();
+    session->open(client, hal::readMicros());
+    g_state_mutex.unlock();
+    printf("Accepted client from %s\r\n", socket_address.get_ip_address());
+  }
+}
+
+/*
+Reads and answers everything the client sent since the last call.
+@return false if the client closed the connection, the connection failed or the request stream is corrupt
+*/
+bool serviceSession(ClientSession &session)
+{
+  while (true)
+  {
+    /* read data into the framer's ring buffer, without blocking */
+    uint32_t space;
+    uint8_t *buffer = session.framer().recvBuffer(space);
+    uint32_t start_cycles = hal::cycleCount();
+    int n = session.socket()->recv(buffer, space);
+
+    /*
+    n represents the response message for the read() command.
+    - if n == 0 then the client closed the connection
+    - otherwise, n is the number of bytes read
+    */
+    if (n == NSAPI_ERROR_WOULD_BLOCK)
+    {
+      return true;
+    }
+    if (n < 0)
+    {
+      printf("Error receiving from client. Error code: %i\r\n", n);
+      return false;
+    }
+    if (n == 0)
+    {
+      printf("Client Closed Connection\n");
+      return false;
+    }
+    g_profiler.record(ProfileStage_STAGE_RECV, hal::cycleCount() - start_cycles);
+    if (DEBUG)
+    {
+      printf("Received Request of size: %d\n", n);
+    }
+    session.framer().commit(n);
+    session.touch(hal::readMicros());
+
+    /* Apply every complete request in the order it was sent. The control thread can't run until the
+     * mutex is released, so when several setpoints arrived in one read only the newest is used. */
+    RequestMessage request;
+    RequestMessage newest = RequestMessage_init_zero;
+    RequestFramer::Status status;
+    int requests = 0;
+    g_state_mutex.lock();
+    start_cycles = hal::cycleCount();
+    while ((status = session.framer().nextFrame(request)) == RequestFramer::Status::FRAME)
+    {
+      uint32_t parse_cycles = hal::cycleCount();
+      g_profiler.record(ProfileStage_STAGE_DECODE, parse_cycles - start_cycles);
+      applyRequest(session, request);
+      newest = request;
+      ++requests;
+      start_cycles = hal::cycleCount();
+      g_profiler.record(ProfileStage_STAGE_PARSE, start_cycles - parse_cycles);
+    }
+    g_state_mutex.unlock();
+
+    if (status == RequestFramer::Status::ERROR)
+    {
+      printf("Request stream corrupt, dropping client\r\n");
+      return false;
+    }
+
+    /* one response per read, however many requests it carried */
+    if (requests > 0)
+    {
+      fillResponse(newest, session);
+      if (!sendResponse(session))
+      {
+        printf("Couldn't send response to client!\r\n");
+        return false;
+      }
+    }
+  }
+}
+
+/* Runs every NETWORK_POLL_MS. Takes command away from a silent commander, evicts dead clients and pushes
+ * telemetry */
+void pollSessions()
+{
+  uint64_t now_us = hal::readMicros();
+  if (g_commander != nullptr && g_commander->idleUs(now_us) > COMMANDER_TIMEOUT_MS * 1000ull)
+  {
+    printf("Commander timed out\r\n");
+    releaseCommand();
+  }
+
+  for (ClientSession &session : g_sessions)
+  {
+    // clients that receive pushes are watched by TCP keepalive instead
+    if (session.isOpen() && session.pushPeriodMs() == 0 &&
+        session.idleUs(now_us) > SESSION_IDLE_TIMEOUT_MS * 1000ull)
+    {
+      printf("Client timed out\r\n");
+      closeSession(session);
+    }
+  }
+
+  pushTelemetry([](ClientSession &session) {
+    if (!sendResponse(session))
+    {
+      printf("Couldn't push telemetry to client!\r\n");
+      closeSession(session);
+    }
+  });
+}
+
+/* Closes a TCP session, or forgets the UDP host. Losing the commander stops the motors */
+void closeSession(ClientSession &session)
+{
+  if (&session == g_commander)
+  {
+    releaseCommand();
+  }
+  session.close();
+  updatePushPeriod();
+}
+
+/* Stops the motors until a client takes command again */
+void releaseCommand()
+{
+  g_state_mutex.lock();
+  triggerEstop();
+  g_state_mutex.unlock();
+  g_commander = nullptr;
+  g_mbed_led2 = 1;
+}
+
+/*
+Applies one request of a client. Only the commander's requests change the control state, but every client
+has its own telemetry subscription. Must hold g_state_mutex.
+*/
+void applyRequest(ClientSession &session, const RequestMessage &request)
+{
+  if (g_commander == nullptr && isCommand(request))
+  {
+    printf("Client took command\r\n");
+    g_commander = &session;
+    g_clock_sync.reset();
+    g_mbed_led2 = 0;
+  }
+  if (&session == g_commander)
+  {
+    parseRequest(request, session.paramReply());
+  }
+  else
+  {
+    refuseParams(request, session.paramReply());
+  }
+  if (request.has_get_params && request.get_params)
+  {
+    session.paramReply().send_params = true;
+  }
+  session.configure(request);
+  updatePushPeriod();
+}
+
+/* Whether the request changes the control state, as opposed to only subscribing to telemetry */
+bool isCommand(const RequestMessage &request)
+{
+  return request.has_p_l || request.has_speed_l || request.has_linear_velocity || request.trajectory_count > 0 ||
+         (request.has_reset_odometry && request.reset_odometry) || request.has_pose_x || request.has_sysid ||
+         request.has_sysid_stop || request.set_params_count > 0 || (request.has_save_params && request.save_params) ||
+         request.has_command_timeout_ms;
+}
+
+/* Ticks are recorded at the shortest push period any client asked for, and pushed to all of them */
+void updatePushPeriod()
+{
+  uint32_t period_ms = 0;
+  for (const ClientSession &session : g_sessions)
+  {
+    uint32_t requested = session.isOpen() ? session.pushPeriodMs() : 0;
+    if (requested != 0 && (period_ms == 0 || requested < period_ms))
+    {
+      period_ms = requested;
+    }
+  }
+  g_tick_recorder.setPushPeriod(period_ms);
+}
+
+int serveUdp(hal::EthernetInterface &net, hal::Serial &pc)
+{
+  hal::UDPSocket socket;
+  if (int ret = socket.open(&net); ret != 0)
+  {
+    pc.printf("Error opening UDPSocket. Error code: %i\r\n", ret);
+    return 1;
+  }
+
+  if (int ret = socket.bind(MBED_IP, SERVER_PORT); ret != 0)
+  {
+    pc.printf("Error binding UDPSocket. Error code: %i\r\n", ret);
+    return 1;
+  }
+
+  /* recvfrom() returns NSAPI_ERROR_WOULD_BLOCK every NETWORK_POLL_MS without a request, to push
+   * telemetry and to notice when the host has gone quiet */
+  socket.set_timeout(NETWORK_POLL_MS);
+  CommandFilter filter(UDP_MAX_COMMAND_DELAY_MS * 1000, UDP_SESSION_TIMEOUT_MS * 1000);
+
+  /* The host in command. Another sender takes its place only once it has been silent for
+   * UDP_SESSION_TIMEOUT_MS, like a TCP client taking command, and the motors stop on every handover */
+  hal::SocketAddress host;
+  ClientSession &session = g_sessions[0];
+  g_mbed_led2 = 1;
+  pc.printf("Waiting for requests...\r\n");
+
+  while (true)
+  {
+    hal::SocketAddress sender;
+    uint32_t start_cycles = hal::cycleCount();
+    int n = socket.recvfrom(&sender, g_request_buffer, sizeof(g_request_buffer));
+    uint64_t now_us = hal::readMicros();
+    if (n >= 0)
+    {
+      g_profiler.record(ProfileStage_STAGE_RECV, hal::cycleCount() - start_cycles);
+    }
+
+    if (n == NSAPI_ERROR_WOULD_BLOCK)
+    {
+      if (session.isOpen() && session.idleUs(now_us) > UDP_SESSION_TIMEOUT_MS * 1000ull)
+      {
+        pc.printf("Host timed out\r\n");
+        closeSession(session);
+      }
+      pushTelemetry([&](ClientSession &) {
+        if (!sendResponse(socket, host))
+        {
+          printf("Couldn't push telemetry to host!\r\n");
+        }
+      });
+      continue;
+    }
+    if (n < 0)
+    {
+      printf("Error receiving datagram. Error code: %i\r\n", n);
+      hal::wait_ms(10);
+      continue;
+    }
+
+    /* every datagram holds exactly one request, without a length prefix */
+    RequestMessage request = RequestMessage_init_zero;
+    pb_istream_t istream = pb_istream_from_buffer(g_request_buffer, n);
+    start_cycles = hal::cycleCount();
+    if (!pb_decode(&istream, RequestMessage_fields, &request))
+    {
+      printf("Decoding failed: %s\n", PB_GET_ERROR(&istream));
+      continue;
+    }
+    g_profiler.record(ProfileStage_STAGE_DECODE, hal::cycleCount() - start_cycles);
+
+    if (session.isOpen() && sender != host)
+    {
+      if (session.idleUs(now_us) <= UDP_SESSION_TIMEOUT_MS * 1000ull)
+      {
+        if (DEBUG)
+        {
+          printf("Ignored request from %s\n", sender.get_ip_address());
+        }
+        continue;
+      }
+      pc.printf("Host timed out\r\n");
+      closeSession(session);
+    }
+    if (!session.isOpen())
+    {
+      pc.printf("Accepted host %s\r\n", sender.get_ip_address());
+      host = sender;
+      g_state_mutex.lock();
+      session.open(nullptr, now_us);
+      // the new host starts from rest, not from whatever the previous one had the robot doing
+      triggerEstop();
+      g_state_mutex.unlock();
+      updatePushPeriod();
+      filter.reset();
+      g_clock_sync.reset();
+      g_commander = &session;
+      g_mbed_led2 = 0;
+    }
+
+    session.touch(now_us);
+    CommandFilter::Verdict verdict = filter.check(request, now_us);
+    g_state_mutex.lock();
+    if (verdict == CommandFilter::Verdict::ACCEPT)
+    {
+      start_cycles = hal::cycleCount();
+      applyRequest(session, request);
+      g_profiler.record(ProfileStage_STAGE_PARSE, hal::cycleCount() - start_cycles);
+    }
+    g_state_mutex.unlock();
+
+    if (DEBUG && verdict != CommandFilter::Verdict::ACCEPT)
+    {
+      printf("Dropped request %lu, delay %li us\n", static_cast<unsigned long>(request.seq),
+             static_cast<long>(filter.lastDelay()));
+    }
+
+    /* Dropped requests are still answered, the telemetry is current either way */
+    fillResponse(request, session);
+    if (!sendResponse(socket, host))
+    {
+      printf("Couldn't send response to host!\r\n");
+    }
+    pushTelemetry([&](ClientSession &) {
+      if (!sendResponse(socket, host))
+      {
+        printf("Couldn't push telemetry to host!\r\n");
+      }
+    });
+  }
+}
+
+/*
+Follows the e-stop switch. Runs on the control thread every period and right after the e-stop interrupt, so
+it doesn't depend on the network. While the switch is pressed the host's setpoints keep being cleared, so
+nothing winds up. Must hold g_state_mutex.
+*/
+void pollEstop()
+{
+  if (g_e_stop_status.read() == 0)
+  {
+    triggerEstop();
+  }
+  else
+  {
+    g_estop = 1;
+    g_safety_light_enable = 0;
+    g_motor_controller.releaseStop();
+  }
+}
+
+/*
+Sends g_response to a TCP client. The socket doesn't block, so a client whose send buffer is full fails
+here; a partial message would break the framing of the stream, so such a client has to be dropped.
+*/
+bool sendResponse(ClientSession &session)
+{
+  size_t response_length = encodeResponse(g_response, g_response_buffer, sizeof(g_response_buffer), true);
+  if (response_length == 0)
+  {
+    return false;
+  }
+
+  uint32_t start_cycles = hal::cycleCount();
+  bool sent = session.socket()->send(g_response_buffer, response_length) == static_cast<int>(response_length);
+  g_profiler.record(ProfileStage_STAGE_SEND, hal::cycleCount() - start_cycles);
+  return sent;
+}
+
+bool sendResponse(hal::UDPSocket &socket, const hal::SocketAddress &host)
+{
+  size_t response_length = encodeResponse(g_response, g_response_buffer, sizeof(g_response_buffer), false);
+  if (response_length == 0)
+  {
+    return false;
+  }
+
+  uint32_t start_cycles = hal::cycleCount();
+  bool sent = socket.sendto(host, g_response_buffer, response_length) >= 0;
+  g_profiler.record(ProfileStage_STAGE_SEND, hal::cycleCount() - start_cycles);
+  return sent;
+}
+
+/*
+If a push is due, sends every client that asked for pushes the telemetry groups due for it, then the ticks
+recorded since the last push in messages holding only samples.
+@param[in] send sends g_response to one session
+*/
+template <typename Send>
+void pushTelemetry(Send send)
+{
+  if (!g_tick_recorder.pushDue(hal::readMicros()))
+  {
+    return;
+  }
+
+  static const RequestMessage no_request = RequestMessage_init_zero;
+  for (ClientSession &session : g_sessions)
+  {
+    if (session.isOpen() && session.pushPeriodMs() != 0)
+    {
+      fillResponse(no_request, session);
+      send(session);
+    }
+  }
+
+  // ticks recorded while sending wait for the next push
+  uint32_t pending = g_tick_recorder.pending();
+  for (uint32_t batch = 0; batch < pending; batch += TickRecorder::BATCH_SIZE)
+  {
+    g_response = ResponseMessage_init_zero;
+    g_tick_recorder.fillSamples(g_response, hal::readMicros());
+    fillClock(g_response);
+    for (ClientSession &session : g_sessions)
+    {
+      if (session.isOpen() && session.pushPeriodMs() != 0)
+      {
+        send(session);
+      }
+    }
+  }
+}
+
+/*
+Fill in the message fields of g_response
+@param[in] request the request being answered, its seq and host_time_us are echoed
+@param[in] session the client being answered, its subscription decides which fields are filled
+*/
+void fillResponse(const RequestMessage &request, ClientSession &session)
+{
+  ResponseMessage &response = g_response;
+  response = ResponseMessage_init_zero;
+  response.has_seq = request.has_seq;
+  response.seq = request.seq;
+  response.has_host_time_us = request.has_host_time_us;
+  response.host_time_us = request.host_time_us;
+  fillClock(response);
+  if (request.has_clock_sync)
+  {
+    // t2 is stamped again right before encoding, see encodeResponse()
+    ClockSyncReply &reply = response.clock_sync;
+    response.has_clock_sync = true;
+    reply.t0_us = request.clock_sync.t0_us;
+    reply.t1_us = session.lastActiveUs();
+    reply.t2_us = response.mbed_time_us;
+    if (g_clock_sync.synced())
+    {
+      reply.has_offset_us = true;
+      reply.has_drift_ppm = true;
+      reply.has_delay_us = true;
+      reply.offset_us = g_clock_sync.offsetUs(response.mbed_time_us);
+      reply.drift_ppm = g_clock_sync.driftPpm();
+      reply.delay_us = static_cast<uint32_t>(g_clock_sync.lastDelayUs());
+    }
+  }
+  response.has_commander = true;
+  response.commander = &session == g_commander;
+  if (session.takeFirstResponse())
+  {
+    response.has_reset_reason = true;
+    response.reset_reason = toResetReason(g_reset_reason);
+    response.has_param_source = true;
+    response.param_source = g_param_source;
+  }
+
+  g_state_mutex.lock();
+  const uint32_t groups = session.telemetry().nextResponse();
+  fillParams(response, session.paramReply());
+
+  if (TelemetrySchedule::contains(groups, TelemetryGroup_TELEMETRY_GAINS))
+  {
+    response.has_p_l = true;
+    response.has_p_r = true;
+    response.has_i_l = true;
+    response.has_i_r = true;
+    response.has_d_l = true;
+    response.has_d_r = true;
+    response.has_kv_l = true;
+    response.has_kv_r = true;
+    response.p_l = static_cast<float>(g_motor_coeffs.left.k_p);
+    response.p_r = static_cast<float>(g_motor_coeffs.right.k_p);
+    response.i_l = static_cast<float>(g_motor_coeffs.left.k_i);
+    response.i_r = static_cast<float>(g_motor_coeffs.right.k_i);
+    response.d_l = static_cast<float>(g_motor_coeffs.left.k_d);
+    response.d_r = static_cast<float>(g_motor_coeffs.right.k_d);
+    response.kv_l = static_cast<float>(g_motor_coeffs.left.k_kv);
+    response.kv_r = static_cast<float>(g_motor_coeffs.right.k_kv);
+  }
+
+  if (TelemetrySchedule::contains(groups, TelemetryGroup_TELEMETRY_SPEED))
+  {
+    response.has_speed_l = true;
+    response.has_speed_r = true;
+    response.has_dt_sec = true;
+    response.speed_l = toFloat(g_motor_pair.left.actual_speed);
+    response.speed_r = toFloat(g_motor_pair.right.actual_speed);
+    response.dt_sec = static_cast<float>(g_last_period_us) / 1e6f;
+    response.has_trajectory_queued = true;
+    response.has_trajectory_underruns = true;
+    response.trajectory_queued = g_setpoint_queue.queued();
+    response.trajectory_underruns = g_setpoint_queue.underruns();
+    response.has_twist_saturations = true;
+    response.twist_saturations = g_twist_limiter.saturations();
+  }
+
+  if (TelemetrySchedule::contains(groups, TelemetryGroup_TELEMETRY_OUTPUT))
+  {
+    response.has_left_output = true;
+    response.has_right_output = true;
+    response.left_output = g_motor_pair.left.ctrl_output;
+    response.right_output = g_motor_pair.right.ctrl_output;
+  }
+
+  if (TelemetrySchedule::contains(groups, TelemetryGroup_TELEMETRY_VOLTAGE))
+  {
+    response.has_voltage = true;
+    response.has_battery_low = true;
+    response.has_battery_low_events = true;
+    response.voltage = static_cast<float>(g_battery_monitor.millivolts()) / 1000.0f;
+    response.battery_low = g_battery_monitor.isLow();
+    response.battery_low_events = g_battery_monitor.lowEvents();
+  }
+
+  if (TelemetrySchedule::contains(groups, TelemetryGroup_TELEMETRY_ESTOP))
+  {
+    response.has_estop = true;
+    response.estop = static_cast<bool>(g_estop);
+    response.has_estop_interrupts = true;
+    response.has_estop_latency_us = true;
+    response.has_estop_max_latency_us = true;
+    response.estop_interrupts = g_motor_controller.getEmergencyStops();
+    response.estop_latency_us = g_motor_controller.getStopLatencyUs();
+    response.estop_max_latency_us = g_motor_controller.getMaxStopLatencyUs();
+    response.has_failsafe = true;
+    response.has_failsafe_trips = true;
+    response.has_failsafe_latency_us = true;
+    response.failsafe = g_command_timeout.tripped();
+    response.failsafe_trips = g_command_timeout.trips();
+    response.failsafe_latency_us = g_command_timeout.lastLatencyUs();
+  }
+
+  if (TelemetrySchedule::contains(groups, TelemetryGroup_TELEMETRY_POSE))
+  {
+    const Pose pose = g_odometry.getPose();
+    response.has_pose_x = true;
+    response.has_pose_y = true;
+    response.has_pose_theta = true;
+    response.has_distance = true;
+    response.pose_x = pose.x;
+    response.pose_y = pose.y;
+    response.pose_theta = pose.theta;
+    response.distance = pose.distance;
+
+    const EncoderSnapshot &encoder = g_encoder_snapshot;
+    response.has_ticks_forward_l = true;
+    response.has_ticks_reverse_l = true;
+    response.has_ticks_forward_r = true;
+    response.has_ticks_reverse_r = true;
+    response.ticks_forward_l = encoder.left_forward_total;
+    response.ticks_reverse_l = encoder.left_reverse_total;
+    response.ticks_forward_r = encoder.right_forward_total;
+    response.ticks_reverse_r = encoder.right_reverse_total;
+  }
+
+  // the statistics cover the time since they were last sent to this client, and there are none if no tick ran
+  if (TelemetrySchedule::contains(groups, TelemetryGroup_TELEMETRY_LOOP_TIMING))
+  {
+    LoopTiming &timing = session.loopTiming();
+    response.has_min_period_us = timing.ticked();
+    response.has_max_period_us = timing.ticked();
+    response.has_max_jitter_us = timing.ticked();
+    response.min_period_us = timing.min_period_us;
+    response.max_period_us = timing.max_period_us;
+    response.max_jitter_us = timing.max_jitter_us;
+    timing = LoopTiming();
+  }
+
+  if (g_sysid.state() != SysIdState_SYSID_IDLE)
+  {
+    response.has_sysid = true;
+    g_sysid.fillStatus(response.sysid, response.mbed_time_us);
+  }
+
+  // under the mutex, since the control thread records STAGE_PID
+  if (TelemetrySchedule::contains(groups, TelemetryGroup_TELEMETRY_DIAGNOSTICS))
+  {
+    response.has_diagnostics = true;
+    fillDiagnostics(response.diagnostics);
+    /* A window per client would take a StageProfiler each. Instead the window is that of one subscriber, the
+     * first one, until it closes or unsubscribes; the others see how far it got */
+    ClientSession *&reader = g_diagnostics_reader;
+    if (reader == nullptr || !reader->isOpen() ||
+        !reader->telemetry().subscribed(TelemetryGroup_TELEMETRY_DIAGNOSTICS))
+    {
+      reader = &session;
+    }
+    if (&session == reader)
+    {
+      g_profiler.reset();
+    }
+  }
+  g_state_mutex.unlock();
+}
+
+/* Answers the parameter requests of the session since its last response, and clears them. Must hold
+ * g_state_mutex */
+void fillParams(ResponseMessage &response, ClientSession::ParamReply &reply)
+{
+  static_assert(ParamRegistry::PARAM_COUNT <= sizeof(response.params) / sizeof(response.params[0]),
+                "ResponseMessage.params max_count in igvc.options is too small");
+  if (reply.send_params)
+  {
+    response.params_count = ParamRegistry::PARAM_COUNT;
+    for (int id = 0; id < ParamRegistry::PARAM_COUNT; ++id)
+    {
+      response.params[id] = g_params.get(static_cast<ParamId>(id));
+    }
+  }
+  response.params_rejected_count = 0;
+  for (int id = 0; id < ParamRegistry::PARAM_COUNT; ++id)
+  {
+    if (reply.rejected_mask & (1u << id))
+    {
+      response.params_rejected[response.params_rejected_count++] = static_cast<ParamId>(id);
+    }
+  }
+  response.has_param_save = reply.has_save;
+  response.param_save = reply.save;
+  reply = ClientSession::ParamReply();
+}
+
+/* Stage statistics since the diagnostics reader's last report, and the OS statistics. Must hold g_state_mutex */
+void fillDiagnostics(Diagnostics &diagnostics)
+{
+  diagnostics.stages_count = 0;
+  for (int stage = 0; stage < StageProfiler::STAGE_COUNT; ++stage)
+  {
+    const StageProfiler::Stats &stats = g_profiler.stats(static_cast<ProfileStage>(stage));
+    StageStats &out = diagnostics.stages[diagnostics.stages_count++];
+    out.has_stage = true;
+    out.has_count = true;
+    out.has_min_cycles = true;
+    out.has_max_cycles = true;
+    out.has_mean_cycles = true;
+    out.stage = static_cast<ProfileStage>(stage);
+    out.count = stats.count;
+    out.min_cycles = stats.count > 0 ? stats.min_cycles : 0;
+    out.max_cycles = stats.max_cycles;
+    out.mean_cycles = stats.count > 0 ? static_cast<uint32_t>(stats.total_cycles / stats.count) : 0;
+    out.histogram_count = StageProfiler::HISTOGRAM_BINS;
+    for (int bin = 0; bin < StageProfiler::HISTOGRAM_BINS; ++bin)
+    {
+      out.histogram[bin] = stats.histogram[bin];
+    }
+  }
+
+  hal::SystemStats system;
+  hal::readSystemStats(system);
+  diagnostics.has_cycles_per_us = true;
+  diagnostics.has_uptime_us = true;
+  diagnostics.has_idle_us = true;
+  diagnostics.has_sleep_us = true;
+  diagnostics.has_heap_current = true;
+  diagnostics.has_heap_max = true;
+  diagnostics.has_heap_reserved = true;
+  diagnostics.has_heap_alloc_fail = true;
+  diagnostics.has_os_version = true;
+  diagnostics.cycles_per_us = system.cycles_per_us;
+  diagnostics.uptime_us = system.uptime_us;
+  diagnostics.idle_us = system.idle_us;
+  diagnostics.sleep_us = system.sleep_us;
+  diagnostics.heap_current = system.heap_current;
+  diagnostics.heap_max = system.heap_max;
+  diagnostics.heap_reserved = system.heap_reserved;
+  diagnostics.heap_alloc_fail = system.heap_alloc_fail;
+  diagnostics.os_version = system.os_version;
+
+  diagnostics.threads_count = 0;
+  for (int i = 0; i < system.thread_count; ++i)
+  {
+    ThreadStats &out = diagnostics.threads[diagnostics.threads_count++];
+    out.has_name = system.threads[i].name != nullptr;
+    if (out.has_name)
+    {
+      strncpy(out.name, system.threads[i].name, sizeof(out.name) - 1);
+      out.name[sizeof(out.name) - 1] = '\0';
+    }
+    out.has_stack_size = true;
+    out.has_stack_free = true;
+    out.stack_size = system.threads[i].stack_size;
+    out.stack_free = system.threads[i].stack_free;
+  }
+}
+
+ResetReason toResetReason(hal::ResetReason reason)
+{
+  switch (reason)
+  {
+    case hal::ResetReason::POWER_ON:
+      return ResetReason_RESET_POWER_ON;
+    case hal::ResetReason::EXTERNAL:
+      return ResetReason_RESET_EXTERNAL;
+    case hal::ResetReason::WATCHDOG:
+      return ResetReason_RESET_WATCHDOG;
+    case hal::ResetReason::BROWN_OUT:
+      return ResetReason_RESET_BROWN_OUT;
+    default:
+      return ResetReason_RESET_UNKNOWN;
+  }
+}
+
+/* Stamps the response with the mbed clock, and with the commander's once synchronized with it */
+void fillClock(ResponseMessage &response)
+{
+  response.has_mbed_time_us = true;
+  response.mbed_time_us = hal::readMicros();
+  if (g_clock_sync.synced())
+  {
+    response.has_synced_time_us = true;
+    response.synced_time_us = g_clock_sync.toHostTime(response.mbed_time_us);
+    response.has_command_time_us = g_command_applied_us != 0;
+    response.command_time_us = g_clock_sync.toHostTime(g_command_applied_us);
+  }
+}
+
+/*
+@param[in] response also gets the send time of its clock_sync answer, as late as possible: whatever happens
+after the stamp counts as network delay, which skews the clock estimate by half of it
+@param[in] delimited prefix the message with its length, for stream transports
+@return the encoded length, or 0 on failure
+*/
+size_t encodeResponse(ResponseMessage &response, uint8_t *buffer, size_t size, bool delimited)
+{
+  if (response.has_clock_sync)
+  {
+    response.clock_sync.t2_us = hal::readMicros();
+  }
+
+  /* Create a stream that will write to our buffer. */
+  pb_ostream_t ostream = pb_ostream_from_buffer(buffer, size);
+
+  /* encode the message */
+  uint32_t start_cycles = hal::cycleCount();
+  bool ostatus = delimited ? pb_encode_delimited(&ostream, ResponseMessage_fields, &response)
+                           : pb_encode(&ostream, ResponseMessage_fields, &response);
+  g_profiler.record(ProfileStage_STAGE_ENCODE, hal::cycleCount() - start_cycles);
+  size_t response_length = ostream.bytes_written;
+
+  if (DEBUG)
+  {
+    printf("Sending message of length: %zu\n", response_length);
+  }
+
+  /* Then just check for any errors.. */
+  if (!ostatus)
+  {
+    printf("Encoding failed: %s\n", PB_GET_ERROR(&ostream));
+    return 0;
+  }
+  return response_length;
+}
+
+void triggerEstop()
+{
+  // If get 5V, since inverted, meaning disabled on motors
+  g_estop = 0;
+  g_motor_pair.left.desired_speed = ControlScalar();
+  g_motor_pair.right.desired_speed = ControlScalar();
+  g_setpoint_queue.clear();
+  g_twist_limiter.clear();
+  g_sysid.abort();
+  g_controller_l.resetIntegral();
+  g_controller_r.resetIntegral();
+  g_motor_controller.stopMotors();
+  g_safety_light_enable = 1;
+}
+
+/*
+Update global variables using most recent client request.
+@param[in] req RequestMessage protobuf with desired values
+@param[out] reply the outcome of its parameter requests
+*/
+void parseRequest(const RequestMessage &req, ClientSession::ParamReply &reply)
+{
+  /* request contains PID values, which are parameters like those in set_params */
+  if (req.has_p_l)
+  {
+    const float gains[] = { req.p_l, req.p_r, req.i_l, req.i_r, req.d_l, req.d_r, req.kv_l, req.kv_r };
+    for (int i = 0; i < 8; ++i)
+    {
+      Param param = Param_init_zero;
+      param.id = static_cast<ParamId>(ParamId_PARAM_P_L + i);
+      param.has_float_value = true;
+      param.float_value = gains[i];
+      setParam(param, reply);
+    }
+  }
+  if (req.has_command_timeout_ms)
+  {
+    Param param = Param_init_zero;
+    param.id = ParamId_PARAM_COMMAND_TIMEOUT_MS;
+    param.has_uint_value = true;
+    param.uint_value = req.command_timeout_ms == 0 ? COMMAND_TIMEOUT_MS : req.command_timeout_ms;
+    setParam(param, reply);
+  }
+  for (pb_size_t i = 0; i < req.set_params_count; ++i)
+  {
+    setParam(req.set_params[i], reply);
+  }
+  if (req.has_p_l || req.has_command_timeout_ms || req.set_params_count > 0)
+  {
+    applyParams();
+  }
+
+  /* new setpoints end system identification */
+  if (req.trajectory_count > 0 || req.has_linear_velocity || req.has_speed_l ||
+      (req.has_sysid_stop && req.sysid_stop))
+  {
+    g_sysid.abort();
+  }
+  if (req.has_sysid_stop && req.sysid_stop)
+  {
+    g_sysid.clear();
+  }
+
+  /* request contains a trajectory, see SetpointQueue */
+  if (req.trajectory_count > 0)
+  {
+    g_twist_limiter.clear();
+    uint64_t now_us = hal::readMicros();
+    uint64_t start_us = now_us;
+    if (req.has_host_time_us)
+    {
+      // without a synchronized clock, the fastest request so far is taken to have had no delay
+      start_us = g_clock_sync.synced() ? g_clock_sync.toMbedTime(req.host_time_us)
+                                       : g_setpoint_queue.toLocalTime(req.host_time_us, now_us);
+    }
+    g_command_applied_us = now_us;
+    g_command_timeout.commandReceived(now_us);
+    SetpointQueue<ControlScalar>::Point points[sizeof(req.trajectory) / sizeof(req.trajectory[0])];
+    for (pb_size_t i = 0; i < req.trajectory_count; ++i)
+    {
+      const TrajectoryPoint &point = req.trajectory[i];
+      points[i] = { start_us + point.offset_us, ControlScalar(point.speed_l), ControlScalar(point.speed_r) };
+    }
+    g_setpoint_queue.push(points, req.trajectory_count, now_us, g_motor_pair.left.desired_speed,
+                          g_motor_pair.right.desired_speed);
+  }
+  /* request contains a body velocity, see TwistLimiter */
+  else if (req.has_linear_velocity)
+  {
+    g_setpoint_queue.clear();
+    g_twist_limiter.setTarget(ControlScalar(req.linear_velocity), ControlScalar(req.angular_velocity),
+                              g_motor_pair.left.desired_speed, g_motor_pair.right.desired_speed);
+    g_command_applied_us = hal::readMicros();
+    g_command_timeout.commandReceived(g_command_applied_us);
+  }
+  /* request contains motor velocities */
+  else if (req.has_speed_l)
+  {
+    g_setpoint_queue.clear();
+    g_twist_limiter.clear();
+    g_motor_pair.left.desired_speed = ControlScalar(req.speed_l);
+    g_motor_pair.right.desired_speed = ControlScalar(req.speed_r);
+    g_command_applied_us = hal::readMicros();
+    g_command_timeout.commandReceived(g_command_applied_us);
+  }
+  /* request starts system identification, from rest */
+  if (req.has_sysid)
+  {
+    g_setpoint_queue.clear();
+    g_twist_limiter.clear();
+    g_motor_pair.left.desired_speed = ControlScalar();
+    g_motor_pair.right.desired_speed = ControlScalar();
+    g_sysid.start(req.sysid, g_motor_coeffs.left.k_kv, g_motor_coeffs.right.k_kv, hal::readMicros());
+  }
+  /* request completes a clock synchronization exchange */
+  if (req.has_clock_sync && req.clock_sync.has_last_t3_us)
+  {
+    g_clock_sync.add({ req.clock_sync.last_t0_us, req.clock_sync.last_t1_us, req.clock_sync.last_t2_us,
+                       req.clock_sync.last_t3_us });
+  }
+  /* request resets or overwrites the odometry */
+  if (req.has_reset_odometry && req.reset_odometry)
+  {
+    g_odometry.reset();
+  }
+  if (req.has_pose_x)
+  {
+    g_odometry.setPose(req.pose_x, req.pose_y, req.pose_theta);
+  }
+
+  if (req.has_save_params && req.save_params)
+  {
+    reply.has_save = true;
+    reply.save = saveParams();
+  }
+}
+
+/* Sets one parameter of g_params, or notes in reply that it was refused. Must hold g_state_mutex */
+void setParam(const Param &param, ClientSession::ParamReply &reply)
+{
+  if (!g_params.set(param) && param.id >= 0 && param.id < ParamRegistry::PARAM_COUNT)
+  {
+    reply.rejected_mask |= 1u << param.id;
+  }
+}
+
+/* Answers the parameter changes of a client that isn't the commander: every one of them is refused */
+void refuseParams(const RequestMessage &req, ClientSession::ParamReply &reply)
+{
+  if (req.has_p_l)
+  {
+    for (int i = 0; i < 8; ++i)
+    {
+      reply.rejected_mask |= 1u << (ParamId_PARAM_P_L + i);
+    }
+  }
+  if (req.has_command_timeout_ms)
+  {
+    reply.rejected_mask |= 1u << ParamId_PARAM_COMMAND_TIMEOUT_MS;
+  }
+  for (pb_size_t i = 0; i < req.set_params_count; ++i)
+  {
+    const ParamId id = req.set_params[i].id;
+    if (id >= 0 && id < ParamRegistry::PARAM_COUNT)
+    {
+      reply.rejected_mask |= 1u << id;
+    }
+  }
+  if (req.has_save_params && req.save_params)
+  {
+    reply.has_save = true;
+    reply.save = ParamSaveResult_SAVE_REFUSED_NOT_COMMANDER;
+  }
+}
+
+/* Hands g_params to the control loop. Must hold g_state_mutex */
+void applyParams()
+{
+  const MotorCoeffs previous = g_motor_coeffs;
+  g_motor_coeffs.left.k_p = g_params.getFloat(ParamId_PARAM_P_L);
+  g_motor_coeffs.right.k_p = g_params.getFloat(ParamId_PARAM_P_R);
+  g_motor_coeffs.left.k_i = g_params.getFloat(ParamId_PARAM_I_L);
+  g_motor_coeffs.right.k_i = g_params.getFloat(ParamId_PARAM_I_R);
+  g_motor_coeffs.left.k_d = g_params.getFloat(ParamId_PARAM_D_L);
+  g_motor_coeffs.right.k_d = g_params.getFloat(ParamId_PARAM_D_R);
+  g_motor_coeffs.left.k_kv = g_params.getFloat(ParamId_PARAM_KV_L);
+  g_motor_coeffs.right.k_kv = g_params.getFloat(ParamId_PARAM_KV_R);
+  g_motor_coeffs.left.k_a = g_params.getFloat(ParamId_PARAM_KA_L);
+  g_motor_coeffs.right.k_a = g_params.getFloat(ParamId_PARAM_KA_R);
+  g_controller_l.setCoeffs(g_motor_coeffs.left);
+  g_controller_r.setCoeffs(g_motor_coeffs.right);
+  if (g_motor_coeffs.left != previous.left || g_motor_coeffs.right != previous.right)
+  {
+    for (ClientSession &session : g_sessions)
+    {
+      session.telemetry().markGainsChanged();
+    }
+  }
+
+  PidTuning tuning;
+  tuning.derivative_alpha = g_params.getFloat(ParamId_PARAM_DERIVATIVE_ALPHA);
+  tuning.integral_clamp = g_params.getFloat(ParamId_PARAM_INTEGRAL_CLAMP);
+  tuning.deadband = g_params.getFloat(ParamId_PARAM_DEADBAND);
+  tuning.back_calc_gain = g_params.getFloat(ParamId_PARAM_BACK_CALC_GAIN);
+  g_controller_l.setTuning(tuning);
+  g_controller_r.setTuning(tuning);
+  g_controller_l.select(static_cast<ControllerType>(g_params.getUint(ParamId_PARAM_CONTROLLER_L)));
+  g_controller_r.select(static_cast<ControllerType>(g_params.getUint(ParamId_PARAM_CONTROLLER_R)));
+
+  g_command_timeout.setTimeout(static_cast<int32_t>(g_params.getUint(ParamId_PARAM_COMMAND_TIMEOUT_MS) * 1000));
+  g_setpoint_queue.setLimits(g_params.getFloat(ParamId_PARAM_TRAJECTORY_ACCEL),
+                             g_params.getFloat(ParamId_PARAM_TRAJECTORY_JERK));
+  g_twist_limiter.setLimits(g_params.getFloat(ParamId_PARAM_TWIST_MAX_WHEEL_SPEED),
+                            g_params.getFloat(ParamId_PARAM_TWIST_LINEAR_ACCEL),
+                            g_params.getFloat(ParamId_PARAM_TWIST_ANGULAR_ACCEL));
+  g_twist_limiter.setWheelBase(g_params.getFloat(ParamId_PARAM_WHEEL_BASE));
+  g_odometry.setWheelBase(g_params.getFloat(ParamId_PARAM_WHEEL_BASE));
+}
+
+/*
+Writes g_params to flash. Refused unless the robot stands still, as erasing a sector stalls the control loop
+for ~100 ms. Must hold g_state_mutex.
+*/
+ParamSaveResult saveParams()
+{
+  const ControlScalar zero{};
+  if (g_motor_pair.left.desired_speed != zero || g_motor_pair.right.desired_speed != zero ||
+      g_motor_pair.left.actual_speed != zero || g_motor_pair.right.actual_speed != zero)
+  {
+    return ParamSaveResult_SAVE_REFUSED_MOVING;
+  }
+  if (g_param_store.saveNeedsErase())
+  {
+    hal::startWatchdog(PARAM_SAVE_WATCHDOG_MS);
+  }
+  ParamStore::Result result = g_param_store.save(g_params);
+  hal::startWatchdog(WATCHDOG_TIMEOUT_MS);
+  return result == ParamStore::Result::OK ? ParamSaveResult_SAVE_OK : ParamSaveResult_SAVE_FAILED;
+}
+
+/*
+e-stop switch ISR. The motors are stopped right here, with the stop byte put ahead of anything queued for
+the Sabertooth, so the stop latency depends on neither the network nor the control loop. The rest of the
+state is guarded by g_state_mutex, which an interrupt can't take; the control thread brings it in line
+through pollEstop() as soon as this returns.
+*/
+void onEstopPressed()
+{
+  g_motor_controller.emergencyStop(hal::readMicros());
+  g_safety_light_enable = 1;
+  g_control_thread.flags_set(ESTOP_FLAG);
+}
+
+/*
+Ticker ISR, wakes up the control thread once per control period.
+*/
+void controlTick()
+{
+  g_control_thread.flags_set(CONTROL_TICK_FLAG);
+}
+
+/*
+Body of the control thread. Follows the e-stop switch, runs pid() once per tick and records how far each
+period deviates from CONTROL_PERIOD_US. Samples the battery and feeds the watchdog.
+*/
+void controlLoop()
+{
+  while (true)
+  {
+    uint32_t flags = hal::ThisThread::flags_wait_any(CONTROL_TICK_FLAG | ESTOP_FLAG);
+
+    g_state_mutex.lock();
+    pollEstop();
+    if (flags & CONTROL_TICK_FLAG)
+    {
+      uint64_t now_us = hal::readMicros();
+      auto period_us = static_cast<int32_t>(now_us - g_last_loop_us);
+      g_last_loop_us = now_us;
+
+      int jitter_us = abs(period_us - CONTROL_PERIOD_US);
+      g_last_period_us = period_us;
+      for (ClientSession &session : g_sessions)
+      {
+        session.loopTiming().add(period_us, jitter_us);
+      }
+
+      uint32_t start_cycles = hal::cycleCount();
+      pid();
+      g_profiler.record(ProfileStage_STAGE_PID, hal::cycleCount() - start_cycles);
+    }
+    g_state_mutex.unlock();
+
+    if (flags & CONTROL_TICK_FLAG)
+    {
+      sampleBattery();
+    }
+
+    hal::feedWatchdog();
+  }
+}
+
+/*
+Feeds the latest conversion of the background ADC to g_battery_monitor, and shows a low battery on LED4.
+Only the control thread calls this.
+*/
+void sampleBattery()
+{
+  int raw = hal::readAdcBurst(p19);
+  if (raw >= 0)
+  {
+    g_battery_monitor.addSample(static_cast<uint16_t>(raw));
+  }
+  g_mbed_led4 = g_battery_monitor.isLow() ? 1 : 0;
+}
+
+/*
+Runs the velocity loop of both wheels. The control law itself lives in WheelController, selected per wheel.
+Must be called with g_state_mutex held.
+*/
+void pid()
+{
+  // 1: Calculate dt, as the time between two encoder snapshots so that ticks and dt always match
+  const EncoderSnapshot snapshot = encoders.snapshot();
+  uint64_t elapsed_us = snapshot.time_us - g_encoder_snapshot.time_us;
+  auto period_us = static_cast<int32_t>(elapsed_us);
+  if (g_encoder_snapshot.time_us == 0 || elapsed_us == 0 || elapsed_us > 10 * CONTROL_PERIOD_US)
+  {
+    // first iteration, or the loop was stalled; don't let a bogus dt into the integrator
+    period_us = CONTROL_PERIOD_US;
+  }
+  g_encoder_snapshot = snapshot;
+  g_odometry.update(snapshot.left_ticks, snapshot.right_ticks);
+  const ControlTiming<ControlScalar> timing = ControlTiming<ControlScalar>::fromPeriod(period_us);
+
+  // 2: Convert encoder values into velocity
+  EncoderEdge edge;
+  while (encoders.popLeftEdge(edge, snapshot.time_us))
+  {
+    g_velocity_l.addEdge(edge);
+  }
+  while (encoders.popRightEdge(edge, snapshot.time_us))
+  {
+    g_velocity_r.addEdge(edge);
+  }
+  g_motor_pair.left.actual_speed = g_velocity_l.estimate(snapshot.left_ticks, snapshot.time_us, period_us);
+  g_motor_pair.right.actual_speed = g_velocity_r.estimate(snapshot.right_ticks, snapshot.time_us, period_us);
+
+  // System identification drives the motors itself. When it ends, the controllers take over from rest
+  if (g_sysid.running())
+  {
+    int left_command = 0;
+    int right_command = 0;
+    const SystemIdentifier::WheelSpeed speed_l{ speedFromTicks<float>(snapshot.left_ticks, period_us),
+                                                toFloat(g_motor_pair.left.actual_speed) };
+    const SystemIdentifier::WheelSpeed speed_r{ speedFromTicks<float>(snapshot.right_ticks, period_us),
+                                                toFloat(g_motor_pair.right.actual_speed) };
+    if (!g_sysid.update(snapshot.time_us, speed_l, speed_r, left_command, right_command))
+    {
+      g_controller_l.resetIntegral();
+      g_controller_r.resetIntegral();
+    }
+    driveMotors(snapshot.time_us, left_command, right_command);
+    return;
+  }
+
+  // Trajectory points are followed, and the last speeds held after them, until the command timeout trips. Only
+  // requests reset it, so from there on the setpoints are ramped down like any stale setpoint
+  if (g_setpoint_queue.active())
+  {
+    if (g_command_timeout.tripped())
+    {
+      g_setpoint_queue.clear();
+    }
+    else
+    {
+      g_setpoint_queue.sample(snapshot.time_us, timing, g_motor_pair.left.desired_speed,
+                              g_motor_pair.right.desired_speed);
+    }
+  }
+  // A twist holds until it goes stale, and from there on the setpoints it reached are ramped down
+  else if (g_twist_limiter.active())
+  {
+    if (g_command_timeout.tripped())
+    {
+      g_twist_limiter.clear();
+    }
+    else
+    {
+      g_twist_limiter.update(timing, g_motor_pair.left.desired_speed, g_motor_pair.right.desired_speed);
+    }
+  }
+
+  // Failsafe: setpoints the host stopped renewing are ramped down to zero
+  g_command_timeout.update(snapshot.time_us, timing, g_motor_pair.left.desired_speed,
+                           g_motor_pair.right.desired_speed);
+
+  // 3-8: see PidKernel::update() and the other control laws of WheelController
+  uint32_t start_cycles = hal::cycleCount();
+  int left_signal = g_controller_l.update(g_motor_pair.left.desired_speed, g_motor_pair.left.actual_speed, timing);
+  uint32_t left_cycles = hal::cycleCount();
+  int right_signal = g_controller_r.update(g_motor_pair.right.desired_speed, g_motor_pair.right.actual_speed, timing);
+  uint32_t right_cycles = hal::cycleCount();
+  g_profiler.record(ProfileStage_STAGE_CONTROL_L, left_cycles - start_cycles);
+  g_profiler.record(ProfileStage_STAGE_CONTROL_R, right_cycles - left_cycles);
+
+  driveMotors(snapshot.time_us, left_signal, right_signal);
+}
+
+/* Sends the motor commands of this period and records the tick. Must be called with g_state_mutex held */
+void driveMotors(uint64_t time_us, int left_signal, int right_signal)
+{
+  g_motor_controller.setSpeeds(right_signal, left_signal);
+
+  g_motor_pair.left.ctrl_output = g_motor_controller.getLeftOutput();
+  g_motor_pair.right.ctrl_output = g_motor_controller.getRightOutput();
+
+  g_tick_recorder.record({ static_cast<uint32_t>(time_us), g_motor_pair.left.actual_speed,
+                           g_motor_pair.right.actual_speed, g_motor_pair.left.desired_speed,
+                           g_motor_pair.right.desired_speed,
+                           static_cast<uint8_t>(g_motor_pair.left.ctrl_output),
+                           static_cast<uint8_t>(g_motor_pair.right.ctrl_output) });
+}
@@ -0,0 +1,11 @@
+#ifndef FIRMWARE_H
+#define FIRMWARE_H
+
+/**
+ * Entry point of the firmware application: brings up the network, starts the control thread and
+ * serves requests. Never returns unless the network cannot be set up.
+ * Called from main() on the mbed and from the simulator's main() on Linux.
+ */
+int runFirmware();
+
+#endif  // FIRMWARE_H
@@ -0,0 +1,178 @@
+#ifndef FIXED_POINT_H
+#define FIXED_POINT_H
+
+#include <cstdint>
+
+/**
+ * Signed fixed-point number stored in an int32_t with FRAC_BITS fractional bits.
+ *
+ * The LPC1768 has no FPU, so every float operation is a call into the soft-float library. Fixed-point
+ * arithmetic only needs integer adds, a 32x32->64 multiply (one SMULL) and, for division, a 64-bit
+ * divide. Results saturate instead of wrapping.
+ */
+template <int FRAC_BITS>
+class Fixed
+{
+public:
+  static_assert(FRAC_BITS > 0 && FRAC_BITS < 31, "FRAC_BITS must leave room for a sign and integer part");
+  static constexpr int32_t ONE = int32_t{ 1 } << FRAC_BITS;
+
+  constexpr Fixed() : raw(0)
+  {
+  }
+
+  /* Conversions from float are meant for constants and for values arriving from the host, not the hot path */
+  constexpr explicit Fixed(float value) : raw(saturate(static_cast<int64_t>(value * ONE + (value >= 0 ? 0.5f : -0.5f))))
+  {
+  }
+
+  constexpr explicit Fixed(int value) : raw(saturate(static_cast<int64_t>(value) * ONE))
+  {
+  }
+
+  static constexpr Fixed fromRaw(int32_t raw)
+  {
+    Fixed f;
+    f.raw = raw;
+    return f;
+  }
+
+  /* numerator / denominator computed with a single integer division */
+  static constexpr Fixed fromRatio(int64_t numerator, int64_t denominator)
+  {
+    return fromRaw(saturate(numerator * ONE / denominator));
+  }
+
+  constexpr int32_t toRaw() const
+  {
+    return raw;
+  }
+
+  constexpr explicit operator float() const
+  {
+    return static_cast<float>(raw) / ONE;
+  }
+
+  /* round half away from zero */
+  constexpr int roundToInt() const
+  {
+    return raw >= 0 ? (raw + ONE / 2) >> FRAC_BITS : -((-raw + ONE / 2) >> FRAC_BITS);
+  }
+
+  constexpr Fixed operator-() const
+  {
+    return fromRaw(saturate(-static_cast<int64_t>(raw)));
+  }
+
+  constexpr Fixed operator+(Fixed other) const
+  {
+    return fromRaw(saturate(static_cast<int64_t>(raw) + other.raw));
+  }
+
+  constexpr Fixed operator-(Fixed other) const
+  {
+    return fromRaw(saturate(static_cast<int64_t>(raw) - other.raw));
+  }
+
+  constexpr Fixed operator*(Fixed other) const
+  {
+    return fromRaw(saturate((static_cast<int64_t>(raw) * other.raw) >> FRAC_BITS));
+  }
+
+  constexpr Fixed operator/(Fixed other) const
+  {
+    return other.raw == 0 ? fromRaw(raw >= 0 ? INT32_MAX : INT32_MIN)
+                          : fromRaw(saturate((static_cast<int64_t>(raw) << FRAC_BITS) / other.raw));
+  }
+
+  Fixed &operator+=(Fixed other)
+  {
+    return *this = *this + other;
+  }
+
+  Fixed &operator-=(Fixed other)
+  {
+    return *this = *this - other;
+  }
+
+  Fixed &operator*=(Fixed other)
+  {
+    return *this = *this * other;
+  }
+
+  constexpr bool operator<(Fixed other) const
+  {
+    return raw < other.raw;
+  }
+
+  constexpr bool operator>(Fixed other) const
+  {
+    return raw > other.raw;
+  }
+
+  constexpr bool operator<=(Fixed other) const
+  {
+    return raw <= other.raw;
+  }
+
+  constexpr bool operator>=(Fixed other) const
+  {
+    return raw >= other.raw;
+  }
+
+  constexpr bool operator==(Fixed other) const
+  {
+    return raw == other.raw;
+  }
+
+  constexpr bool operator!=(Fixed other) const
+  {
+    return raw != other.raw;
+  }
+
+private:
+  int32_t raw;
+
+  static constexpr int32_t saturate(int64_t value)
+  {
+    return value > INT32_MAX ? INT32_MAX : (value < INT32_MIN ? INT32_MIN : static_cast<int32_t>(value));
+  }
+};
+
+using Q16_16 = Fixed<16>;
+
+/* Helpers so that templated code can treat float and Fixed the same way */
+template <int FRAC_BITS>
+constexpr Fixed<FRAC_BITS> absolute(Fixed<FRAC_BITS> value)
+{
+  return value < Fixed<FRAC_BITS>() ? -value : value;
+}
+
+constexpr float absolute(float value)
+{
+  return value < 0.0f ? -value : value;
+}
+
+template <int FRAC_BITS>
+constexpr int roundToInt(Fixed<FRAC_BITS> value)
+{
+  return value.roundToInt();
+}
+
+constexpr int roundToInt(float value)
+{
+  return static_cast<int>(value >= 0.0f ? value + 0.5f : value - 0.5f);
+}
+
+template <int FRAC_BITS>
+constexpr float toFloat(Fixed<FRAC_BITS> value)
+{
+  return static_cast<float>(value);
+}
+
+constexpr float toFloat(float value)
+{
+  return value;
+}
+
+#endif  // FIXED_POINT_H
@@ -0,0 +1,15 @@
+#ifndef HAL_H
+#define HAL_H
+
+/**
+ * Thin hardware abstraction layer. Firmware code uses the hal:: names for every peripheral, RTOS and
+ * network type so that it can be built either for the LPC1768 (mbed backend) or natively on Linux
+ * (sim backend, selected with IGVC_SIM).
+ */
+#ifdef IGVC_SIM
+#include "hal/sim_hal.h"
+#else
+#include "hal/mbed_hal.h"
+#endif
+
+#endif  // HAL_H
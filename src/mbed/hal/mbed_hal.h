@@ -0,0 +1,213 @@
+#ifndef MBED_HAL_H
+#define MBED_HAL_H
+
+#include "mbed.h"
+#include "cmsis.h"
+#include "platform/CriticalSectionLock.h"
+#include "hal/us_ticker_api.h"
+
+#include <EthernetInterface.h>
+
+#include "hal/system_stats.h"
+
+/**
+ * mbed backend of the HAL. The HAL types are the mbed-os types themselves, so it adds no overhead on
+ * target.
+ */
+namespace hal
+{
+using mbed::AnalogIn;
+using mbed::callback;
+using mbed::Callback;
+using mbed::CriticalSectionLock;
+using mbed::DigitalIn;
+using mbed::DigitalOut;
+using mbed::FlashIAP;
+using mbed::InterruptIn;
+using mbed::RawSerial;
+using mbed::Serial;
+using mbed::SerialBase;
+using mbed::Ticker;
+using mbed::Timer;
+
+using events::EventQueue;
+
+using rtos::Mutex;
+using rtos::Thread;
+namespace ThisThread = rtos::ThisThread;
+
+using ::EthernetInterface;
+using ::SocketAddress;
+using ::TCPSocket;
+using ::UDPSocket;
+
+using ::wait_ms;
+
+/* Monotonic microseconds since boot. The mbed ticker layer extends the 32-bit us ticker to 64 bits, so
+ * this never wraps. Safe to call from interrupts */
+inline uint64_t readMicros()
+{
+  return ticker_read_us(get_us_ticker_data());
+}
+
+/* DWT cycle counter of the Cortex-M3, counts core clock cycles (96 MHz) */
+inline void enableCycleCounter()
+{
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+inline uint32_t cycleCount()
+{
+  return DWT->CYCCNT;
+}
+
+/* Discards what waits in the TX FIFO of the UART on tx, so that the next byte written goes out right after
+ * the one being shifted out. Safe to call from interrupts */
+inline void flushSerialTx(PinName tx)
+{
+  constexpr uint8_t FCR_FIFO_ENABLE_TX_RESET = 0x05;
+  switch (tx)
+  {
+    case USBTX:
+      LPC_UART0->FCR = FCR_FIFO_ENABLE_TX_RESET;
+      break;
+    case p13:
+      LPC_UART1->FCR = FCR_FIFO_ENABLE_TX_RESET;
+      break;
+    case p28:
+      LPC_UART2->FCR = FCR_FIFO_ENABLE_TX_RESET;
+      break;
+    case p9:
+      LPC_UART3->FCR = FCR_FIFO_ENABLE_TX_RESET;
+      break;
+    default:
+      break;
+  }
+}
+
+/* LPC1768 ADC channel of an analog pin, -1 for the others */
+inline int adcChannel(PinName pin)
+{
+  switch (pin)
+  {
+    case p15:
+      return 0;
+    case p16:
+      return 1;
+    case p17:
+      return 2;
+    case p18:
+      return 3;
+    case p19:
+      return 4;
+    case p20:
+      return 5;
+    default:
+      return -1;
+  }
+}
+
+/* Puts the ADC in burst mode on pin, which must already be set up by an AnalogIn. The ADC then converts in
+ * the background with its slowest clock, ~1400 times a second, and readAdcBurst() picks up the latest result
+ * without waiting for a conversion. AnalogIn::read() must not be used afterwards, it leaves burst mode */
+inline void startAdcBurst(PinName pin)
+{
+  constexpr uint32_t ADCR_CLKDIV_SLOWEST = 255u << 8;
+  constexpr uint32_t ADCR_BURST = 1u << 16;
+  constexpr uint32_t ADCR_PDN = 1u << 21;
+  LPC_ADC->ADINTEN = 0;
+  LPC_ADC->ADCR = (1u << adcChannel(pin)) | ADCR_CLKDIV_SLOWEST | ADCR_BURST | ADCR_PDN;
+}
+
+/* @return the 12-bit result of the latest conversion on pin, or -1 if there was none since the last call */
+inline int readAdcBurst(PinName pin)
+{
+  constexpr uint32_t ADDR_DONE = 1u << 31;
+  uint32_t result = (&LPC_ADC->ADDR0)[adcChannel(pin)];
+  if (!(result & ADDR_DONE))
+  {
+    return -1;
+  }
+  return static_cast<int>((result >> 4) & 0xFFF);
+}
+
+/* The LPC1768 watchdog runs from the 4 MHz internal RC oscillator divided by 4, i.e. it counts microseconds.
+ * Once started it can't be stopped; the chip resets unless feedWatchdog() is called every timeout_ms.
+ * Calling it again changes the timeout */
+inline void startWatchdog(uint32_t timeout_ms)
+{
+  LPC_WDT->WDCLKSEL = 0;
+  LPC_WDT->WDTC = timeout_ms * 1000;
+  LPC_WDT->WDMOD = 0x3;  // WDEN | WDRESET
+  LPC_WDT->WDFEED = 0xAA;
+  LPC_WDT->WDFEED = 0x55;
+}
+
+/* Any other watchdog access between the two writes resets the chip, so the feed can't be interrupted */
+inline void feedWatchdog()
+{
+  CriticalSectionLock lock;
+  LPC_WDT->WDFEED = 0xAA;
+  LPC_WDT->WDFEED = 0x55;
+}
+
+/*
+Reads and clears the reset source flags (RSID), so only the first call after boot is meaningful. A power-on
+reset usually sets EXTR as well, nRESET being held low while the supply comes up, and may set BODR, so POR is
+tested first
+*/
+inline ResetReason readResetReason()
+{
+  uint32_t rsid = LPC_SC->RSID;
+  LPC_SC->RSID = rsid;
+  if (rsid & (1u << 0))
+  {
+    return ResetReason::POWER_ON;
+  }
+  if (rsid & (1u << 2))
+  {
+    return ResetReason::WATCHDOG;
+  }
+  if (rsid & (1u << 3))
+  {
+    return ResetReason::BROWN_OUT;
+  }
+  if (rsid & (1u << 1))
+  {
+    return ResetReason::EXTERNAL;
+  }
+  return ResetReason::UNKNOWN;
+}
+
+inline void readSystemStats(SystemStats &stats)
+{
+  mbed_stats_cpu_t cpu;
+  mbed_stats_cpu_get(&cpu);
+  stats.uptime_us = cpu.uptime;
+  stats.idle_us = cpu.idle_time;
+  stats.sleep_us = cpu.sleep_time + cpu.deep_sleep_time;
+
+  mbed_stats_heap_t heap;
+  mbed_stats_heap_get(&heap);
+  stats.heap_current = heap.current_size;
+  stats.heap_max = heap.max_size;
+  stats.heap_reserved = heap.reserved_size;
+  stats.heap_alloc_fail = heap.alloc_fail_cnt;
+
+  mbed_stats_sys_t sys;
+  mbed_stats_sys_get(&sys);
+  stats.os_version = sys.os_version;
+  stats.cycles_per_us = SystemCoreClock / 1000000;
+
+  mbed_stats_thread_t threads[MAX_THREAD_STATS];
+  stats.thread_count = static_cast<int>(mbed_stats_thread_get_each(threads, MAX_THREAD_STATS));
+  for (int i = 0; i < stats.thread_count; ++i)
+  {
+    stats.threads[i] = { threads[i].name, threads[i].stack_size, threads[i].stack_space };
+  }
+}
+}  // namespace hal
+
+#endif  // MBED_HAL_H
@@ -0,0 +1,1007 @@
+#include "hal/sim_hal.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstdarg>
+#include <cstring>
+
+namespace hal
+{
+namespace
+{
+struct PinState
+{
+  int value = 0;
+  float analog = 0.0f;
+  std::vector<InterruptIn *> interrupts;
+  std::vector<uint8_t> serial_bytes;
+};
+
+// Function statics, since the firmware's global pin objects are constructed during static initialization
+std::mutex &pinsMutex()
+{
+  static std::mutex mutex;
+  return mutex;
+}
+
+PinState &pinState(PinName pin)
+{
+  static std::array<PinState, PIN_COUNT> pins;
+  return pins.at(static_cast<size_t>(pin));
+}
+
+thread_local std::shared_ptr<ThreadFlags> t_thread_flags;
+
+const auto g_start_time = std::chrono::steady_clock::now();
+std::atomic<std::chrono::steady_clock::duration> g_watchdog_fed{};
+std::atomic<std::chrono::steady_clock::duration> g_watchdog_timeout{};
+
+ThreadFlags &currentThreadFlags()
+{
+  if (!t_thread_flags)
+  {
+    t_thread_flags = std::make_shared<ThreadFlags>();
+  }
+  return *t_thread_flags;
+}
+
+/* Sockets with a sigio() handler, by file descriptor. A helper thread stands in for the network stack
+ * thread of mbed-os: it polls the sockets and calls the handler of each readable one */
+struct SigioSockets
+{
+  std::mutex mutex;
+  std::vector<std::pair<int, Callback<void()>>> handlers;
+};
+
+SigioSockets &sigioSockets()
+{
+  static SigioSockets sockets;
+  return sockets;
+}
+
+void sigioLoop()
+{
+  SigioSockets &sockets = sigioSockets();
+  while (true)
+  {
+    std::vector<pollfd> fds;
+    {
+      std::lock_guard<std::mutex> lock(sockets.mutex);
+      for (const auto &handler : sockets.handlers)
+      {
+        fds.push_back({ handler.first, POLLIN, 0 });
+      }
+    }
+    if (fds.empty() || ::poll(fds.data(), fds.size(), 10) <= 0)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(sockets.mutex);
+      for (const pollfd &fd : fds)
+      {
+        for (const auto &handler : sockets.handlers)
+        {
+          if (fd.revents != 0 && handler.first == fd.fd)
+          {
+            handler.second();
+          }
+        }
+      }
+    }
+    // the firmware reads from another thread; don't spin while the data is still waiting
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+void removeSigio(int fd)
+{
+  SigioSockets &sockets = sigioSockets();
+  std::lock_guard<std::mutex> lock(sockets.mutex);
+  sockets.handlers.erase(std::remove_if(sockets.handlers.begin(), sockets.handlers.end(),
+                                        [fd](const auto &handler) { return handler.first == fd; }),
+                         sockets.handlers.end());
+}
+}  // namespace
+
+/* DigitalOut */
+DigitalOut::DigitalOut(PinName pin, int value) : pin(pin)
+{
+  write(value);
+}
+
+void DigitalOut::write(int value)
+{
+  std::lock_guard<std::mutex> lock(pinsMutex());
+  pinState(pin).value = value;
+}
+
+int DigitalOut::read()
+{
+  std::lock_guard<std::mutex> lock(pinsMutex());
+  return pinState(pin).value;
+}
+
+DigitalOut &DigitalOut::operator=(int value)
+{
+  write(value);
+  return *this;
+}
+
+DigitalOut::operator int()
+{
+  return read();
+}
+
+/* DigitalIn */
+DigitalIn::DigitalIn(PinName pin) : pin(pin)
+{
+}
+
+int DigitalIn::read()
+{
+  return sim::getPin(pin);
+}
+
+DigitalIn::operator int()
+{
+  return read();
+}
+
+/* InterruptIn */
+InterruptIn::InterruptIn(PinName pin) : pin(pin), irq_enabled(true)
+{
+  std::lock_guard<std::mutex> lock(pinsMutex());
+  pinState(pin).interrupts.push_back(this);
+}
+
+InterruptIn::~InterruptIn()
+{
+  std::lock_guard<std::mutex> lock(pinsMutex());
+  auto &interrupts = pinState(pin).interrupts;
+  interrupts.erase(std::remove(interrupts.begin(), interrupts.end(), this), interrupts.end());
+}
+
+int InterruptIn::read()
+{
+  return sim::getPin(pin);
+}
+
+InterruptIn::operator int()
+{
+  return read();
+}
+
+void InterruptIn::rise(Callback<void()> func)
+{
+  rise_handler = std::move(func);
+}
+
+void InterruptIn::fall(Callback<void()> func)
+{
+  fall_handler = std::move(func);
+}
+
+void InterruptIn::enable_irq()
+{
+  irq_enabled = true;
+}
+
+void InterruptIn::disable_irq()
+{
+  irq_enabled = false;
+}
+
+void InterruptIn::edge(int value)
+{
+  if (!irq_enabled)
+  {
+    return;
+  }
+  auto &handler = value ? rise_handler : fall_handler;
+  if (handler)
+  {
+    handler();
+  }
+}
+
+/* AnalogIn */
+AnalogIn::AnalogIn(PinName pin) : pin(pin)
+{
+}
+
+float AnalogIn::read()
+{
+  std::lock_guard<std::mutex> lock(pinsMutex());
+  return pinState(pin).analog;
+}
+
+unsigned short AnalogIn::read_u16()
+{
+  return static_cast<unsigned short>(read() * 0xFFFF);
+}
+
+int readAdcBurst(PinName pin)
+{
+  return static_cast<int>(AnalogIn(pin).read() * 0xFFF);
+}
+
+/* Serial */
+SerialBase::SerialBase(PinName tx, PinName rx, int baud) : tx(tx), baudrate(baud)
+{
+}
+
+void SerialBase::baud(int baudrate)
+{
+  this->baudrate = baudrate;
+}
+
+void SerialBase::attach(Callback<void()> func, IrqType type)
+{
+  if (type == TxIrq)
+  {
+    tx_handler = std::move(func);
+  }
+}
+
+int SerialBase::readable()
+{
+  return 0;
+}
+
+int SerialBase::writeable()
+{
+  return 1;
+}
+
+RawSerial::RawSerial(PinName tx, PinName rx, int baud) : SerialBase(tx, rx, baud)
+{
+}
+
+int RawSerial::putc(int c)
+{
+  std::lock_guard<std::mutex> lock(pinsMutex());
+  pinState(tx).serial_bytes.push_back(static_cast<uint8_t>(c));
+  return c;
+}
+
+int RawSerial::getc()
+{
+  return -1;
+}
+
+Serial::Serial(PinName tx, PinName rx, int baud) : SerialBase(tx, rx, baud)
+{
+}
+
+int Serial::putc(int c)
+{
+  return std::putchar(c);
+}
+
+int Serial::printf(const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  int ret = std::vprintf(format, args);
+  va_end(args);
+  std::fflush(stdout);
+  return ret;
+}
+
+/* Timer */
+Timer::Clock::duration Timer::elapsed()
+{
+  return running ? accumulated + (Clock::now() - start_time) : accumulated;
+}
+
+void Timer::start()
+{
+  if (!running)
+  {
+    start_time = Clock::now();
+    running = true;
+  }
+}
+
+void Timer::stop()
+{
+  accumulated = elapsed();
+  running = false;
+}
+
+void Timer::reset()
+{
+  accumulated = Clock::duration::zero();
+  start_time = Clock::now();
+}
+
+float Timer::read()
+{
+  return std::chrono::duration<float>(elapsed()).count();
+}
+
+int Timer::read_ms()
+{
+  return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed()).count());
+}
+
+int Timer::read_us()
+{
+  return static_cast<int>(read_high_resolution_us());
+}
+
+uint64_t Timer::read_high_resolution_us()
+{
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed()).count());
+}
+
+/* Ticker */
+Ticker::~Ticker()
+{
+  detach();
+}
+
+void Ticker::attach_us(Callback<void()> func, uint64_t period_us)
+{
+  detach();
+  active = true;
+  worker = std::thread([this, func = std::move(func), period_us]() {
+    auto next = std::chrono::steady_clock::now();
+    while (active)
+    {
+      next += std::chrono::microseconds(period_us);
+      std::this_thread::sleep_until(next);
+      std::lock_guard<std::recursive_mutex> irq(sim::interruptLock());
+      func();
+    }
+  });
+}
+
+void Ticker::detach()
+{
+  active = false;
+  if (worker.joinable())
+  {
+    worker.join();
+  }
+}
+
+/* CriticalSectionLock */
+CriticalSectionLock::CriticalSectionLock()
+{
+  sim::interruptLock().lock();
+}
+
+CriticalSectionLock::~CriticalSectionLock()
+{
+  sim::interruptLock().unlock();
+}
+
+/* Mutex */
+void Mutex::lock()
+{
+  mutex.lock();
+}
+
+void Mutex::unlock()
+{
+  mutex.unlock();
+}
+
+bool Mutex::trylock()
+{
+  return mutex.try_lock();
+}
+
+/* Thread */
+Thread::Thread(osPriority_t priority, uint32_t stack_size, unsigned char *stack_mem, const char *name)
+  : thread_flags(std::make_shared<ThreadFlags>())
+{
+}
+
+int Thread::start(Callback<void()> task)
+{
+  // Threads of the firmware never return, so they are simply detached
+  std::thread([flags = thread_flags, task = std::move(task)]() {
+    t_thread_flags = flags;
+    task();
+  }).detach();
+  return 0;
+}
+
+int32_t Thread::flags_set(uint32_t flags)
+{
+  std::lock_guard<std::mutex> lock(thread_flags->mutex);
+  thread_flags->flags |= flags;
+  thread_flags->changed.notify_all();
+  return static_cast<int32_t>(thread_flags->flags);
+}
+
+namespace ThisThread
+{
+uint32_t flags_wait_any_for(uint32_t flags, uint32_t millisec, bool clear)
+{
+  ThreadFlags &state = currentThreadFlags();
+  std::unique_lock<std::mutex> lock(state.mutex);
+  state.changed.wait_for(lock, std::chrono::milliseconds(millisec), [&]() { return (state.flags & flags) != 0; });
+  uint32_t set = state.flags;
+  if (clear)
+  {
+    state.flags &= ~flags;
+  }
+  return set;
+}
+
+uint32_t flags_wait_any(uint32_t flags, bool clear)
+{
+  ThreadFlags &state = currentThreadFlags();
+  std::unique_lock<std::mutex> lock(state.mutex);
+  state.changed.wait(lock, [&]() { return (state.flags & flags) != 0; });
+  uint32_t set = state.flags;
+  if (clear)
+  {
+    state.flags &= ~flags;
+  }
+  return set;
+}
+
+void sleep_for(uint32_t millisec)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(millisec));
+}
+}  // namespace ThisThread
+
+void wait_ms(int ms)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+/* EventQueue */
+EventQueue::EventQueue(unsigned size, unsigned char *buffer) : capacity(size / EVENTS_EVENT_SIZE)
+{
+}
+
+int EventQueue::post(std::function<void()> func, int period_ms)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (events.size() >= capacity)
+  {
+    return 0;
+  }
+  events.push_back({ Clock::now() + std::chrono::milliseconds(period_ms), period_ms, std::move(func) });
+  changed.notify_all();
+  return next_id++;
+}
+
+void EventQueue::dispatch_forever()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true)
+  {
+    auto next = std::min_element(events.begin(), events.end(),
+                                 [](const Event &a, const Event &b) { return a.due < b.due; });
+    if (next == events.end())
+    {
+      changed.wait(lock);
+      continue;
+    }
+    if (next->due > Clock::now())
+    {
+      changed.wait_until(lock, next->due);
+      continue;
+    }
+
+    std::function<void()> func = next->func;
+    if (next->period_ms > 0)
+    {
+      next->due += std::chrono::milliseconds(next->period_ms);
+    }
+    else
+    {
+      events.erase(next);
+    }
+    lock.unlock();
+    func();
+    lock.lock();
+  }
+}
+
+uint64_t readMicros()
+{
+  auto now = std::chrono::steady_clock::now() - g_start_time;
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now).count());
+}
+
+void enableCycleCounter()
+{
+}
+
+uint32_t cycleCount()
+{
+  auto now = std::chrono::steady_clock::now().time_since_epoch();
+  return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count());
+}
+
+void readSystemStats(SystemStats &stats)
+{
+  auto uptime = std::chrono::steady_clock::now() - g_start_time;
+  stats = SystemStats{};
+  stats.uptime_us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(uptime).count());
+  stats.cycles_per_us = 1000;
+}
+
+void startWatchdog(uint32_t timeout_ms)
+{
+  feedWatchdog();
+  auto previous = g_watchdog_timeout.exchange(std::chrono::milliseconds(timeout_ms));
+  if (previous != std::chrono::steady_clock::duration{})
+  {
+    return;
+  }
+  std::thread([]() {
+    while (true)
+    {
+      std::this_thread::sleep_for(g_watchdog_timeout.load() / 4);
+      auto since_feed = std::chrono::steady_clock::now().time_since_epoch() - g_watchdog_fed.load();
+      if (since_feed > g_watchdog_timeout.load())
+      {
+        std::fprintf(stderr, "Watchdog not fed for %lld ms, resetting\n",
+                     static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(since_feed).count()));
+        std::_Exit(EXIT_FAILURE);
+      }
+    }
+  }).detach();
+}
+
+void feedWatchdog()
+{
+  g_watchdog_fed = std::chrono::steady_clock::now().time_since_epoch();
+}
+
+ResetReason readResetReason()
+{
+  return ResetReason::POWER_ON;
+}
+
+/* FlashIAP */
+namespace
+{
+constexpr uint32_t FLASH_SIZE = 512 * 1024;
+constexpr uint32_t FLASH_SMALL_SECTORS_END = 64 * 1024;
+constexpr uint32_t FLASH_PAGE_SIZE = 256;
+}  // namespace
+
+int FlashIAP::init()
+{
+  const char *env = std::getenv("IGVC_SIM_FLASH");
+  path = env != nullptr ? env : "igvc-sim-flash.bin";
+  memory.assign(FLASH_SIZE, 0xFF);
+  if (FILE *file = std::fopen(path.c_str(), "rb"))
+  {
+    size_t n = std::fread(memory.data(), 1, memory.size(), file);
+    std::fclose(file);
+    if (n != memory.size())
+    {
+      memory.assign(FLASH_SIZE, 0xFF);
+    }
+  }
+  return 0;
+}
+
+int FlashIAP::deinit()
+{
+  return 0;
+}
+
+int FlashIAP::read(void *buffer, uint32_t addr, uint32_t size)
+{
+  if (!inRange(addr, size))
+  {
+    return -1;
+  }
+  std::memcpy(buffer, memory.data() + addr, size);
+  return 0;
+}
+
+int FlashIAP::program(const void *buffer, uint32_t addr, uint32_t size)
+{
+  if (!inRange(addr, size) || addr % FLASH_PAGE_SIZE != 0 || size % FLASH_PAGE_SIZE != 0)
+  {
+    return -1;
+  }
+  const auto *bytes = static_cast<const uint8_t *>(buffer);
+  for (uint32_t i = 0; i < size; ++i)
+  {
+    memory[addr + i] &= bytes[i];
+  }
+  return store(addr, size);
+}
+
+int FlashIAP::erase(uint32_t addr, uint32_t size)
+{
+  if (!inRange(addr, size) || addr % get_sector_size(addr) != 0)
+  {
+    return -1;
+  }
+  std::fill(memory.begin() + addr, memory.begin() + addr + size, 0xFF);
+  return store(addr, size);
+}
+
+uint32_t FlashIAP::get_page_size() const
+{
+  return FLASH_PAGE_SIZE;
+}
+
+uint32_t FlashIAP::get_sector_size(uint32_t addr) const
+{
+  return addr < FLASH_SMALL_SECTORS_END ? 4 * 1024 : 32 * 1024;
+}
+
+uint32_t FlashIAP::get_flash_start() const
+{
+  return 0;
+}
+
+uint32_t FlashIAP::get_flash_size() const
+{
+  return FLASH_SIZE;
+}
+
+bool FlashIAP::inRange(uint32_t addr, uint32_t size) const
+{
+  return memory.size() == FLASH_SIZE && addr <= FLASH_SIZE && size <= FLASH_SIZE - addr;
+}
+
+/* Writes the changed range through to the backing file */
+int FlashIAP::store(uint32_t addr, uint32_t size)
+{
+  FILE *file = std::fopen(path.c_str(), "r+b");
+  if (file == nullptr)
+  {
+    file = std::fopen(path.c_str(), "w+b");
+    if (file == nullptr)
+    {
+      return -1;
+    }
+    addr = 0;
+    size = FLASH_SIZE;
+  }
+  bool ok = std::fseek(file, addr, SEEK_SET) == 0 && std::fwrite(memory.data() + addr, 1, size, file) == size;
+  return std::fclose(file) == 0 && ok ? 0 : -1;
+}
+
+/* Network */
+int EthernetInterface::set_network(const char *ip_address, const char *netmask, const char *gateway)
+{
+  return 0;
+}
+
+int EthernetInterface::connect()
+{
+  return 0;
+}
+
+const char *EthernetInterface::get_ip_address()
+{
+  return "127.0.0.1";
+}
+
+SocketAddress::SocketAddress(const char *ip, uint16_t port) : ip(ip ? ip : ""), port(port)
+{
+}
+
+const char *SocketAddress::get_ip_address() const
+{
+  return ip.c_str();
+}
+
+uint16_t SocketAddress::get_port() const
+{
+  return port;
+}
+
+bool operator==(const SocketAddress &a, const SocketAddress &b)
+{
+  return a.get_port() == b.get_port() && std::string(a.get_ip_address()) == b.get_ip_address();
+}
+
+bool operator!=(const SocketAddress &a, const SocketAddress &b)
+{
+  return !(a == b);
+}
+
+TCPSocket::~TCPSocket()
+{
+  if (fd >= 0)
+  {
+    removeSigio(fd);
+    ::close(fd);
+  }
+}
+
+int TCPSocket::open(EthernetInterface *stack)
+{
+  fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+  {
+    return -1;
+  }
+  int reuse = 1;
+  ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  return 0;
+}
+
+int TCPSocket::bind(const char *address, uint16_t port)
+{
+  // The robot's IP does not exist on the host, always serve on loopback instead
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  return ::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+}
+
+int TCPSocket::listen(int backlog)
+{
+  return ::listen(fd, backlog);
+}
+
+TCPSocket *TCPSocket::accept(int *error)
+{
+  int client_fd = ::accept(fd, nullptr, nullptr);
+  if (error)
+  {
+    *error = client_fd >= 0 ? NSAPI_ERROR_OK
+                            : (errno == EAGAIN || errno == EWOULDBLOCK ? NSAPI_ERROR_WOULD_BLOCK
+                                                                       : NSAPI_ERROR_DEVICE_ERROR);
+  }
+  if (client_fd < 0)
+  {
+    return nullptr;
+  }
+  auto *client = new TCPSocket();
+  client->fd = client_fd;
+  client->accepted = true;
+  return client;
+}
+
+void TCPSocket::set_timeout(int timeout_ms)
+{
+  timeval timeout{};
+  if (timeout_ms >= 0)
+  {
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+  }
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+void TCPSocket::set_blocking(bool blocking)
+{
+  int flags = ::fcntl(fd, F_GETFL, 0);
+  ::fcntl(fd, F_SETFL, blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK);
+}
+
+void TCPSocket::sigio(Callback<void()> func)
+{
+  static std::once_flag started;
+  std::call_once(started, []() { std::thread(sigioLoop).detach(); });
+
+  removeSigio(fd);
+  if (func)
+  {
+    SigioSockets &sockets = sigioSockets();
+    std::lock_guard<std::mutex> lock(sockets.mutex);
+    sockets.handlers.emplace_back(fd, std::move(func));
+  }
+}
+
+int TCPSocket::setsockopt(int level, int optname, const void *optval, unsigned optlen)
+{
+  if (level != NSAPI_SOCKET || optlen != sizeof(int))
+  {
+    return NSAPI_ERROR_UNSUPPORTED;
+  }
+  int value = *static_cast<const int *>(optval);
+  int result;
+  switch (optname)
+  {
+    case NSAPI_KEEPALIVE:
+      result = ::setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &value, sizeof(value));
+      break;
+    // Linux counts these in whole seconds
+    case NSAPI_KEEPIDLE:
+      value = std::max(1, (value + 999) / 1000);
+      result = ::setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &value, sizeof(value));
+      break;
+    case NSAPI_KEEPINTVL:
+      value = std::max(1, (value + 999) / 1000);
+      result = ::setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &value, sizeof(value));
+      break;
+    default:
+      return NSAPI_ERROR_UNSUPPORTED;
+  }
+  return result == 0 ? NSAPI_ERROR_OK : NSAPI_ERROR_DEVICE_ERROR;
+}
+
+int TCPSocket::recv(void *data, unsigned size)
+{
+  ssize_t n = ::recv(fd, data, size, 0);
+  if (n < 0)
+  {
+    return errno == EAGAIN || errno == EWOULDBLOCK ? NSAPI_ERROR_WOULD_BLOCK : NSAPI_ERROR_DEVICE_ERROR;
+  }
+  return static_cast<int>(n);
+}
+
+int TCPSocket::send(const void *data, unsigned size)
+{
+  ssize_t n = ::send(fd, data, size, MSG_NOSIGNAL);
+  if (n < 0)
+  {
+    return errno == EAGAIN || errno == EWOULDBLOCK ? NSAPI_ERROR_WOULD_BLOCK : NSAPI_ERROR_DEVICE_ERROR;
+  }
+  return static_cast<int>(n);
+}
+
+int TCPSocket::getpeername(SocketAddress *address)
+{
+  sockaddr_in addr{};
+  socklen_t len = sizeof(addr);
+  if (::getpeername(fd, reinterpret_cast<sockaddr *>(&addr), &len) != 0)
+  {
+    return -1;
+  }
+  char ip[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+  *address = SocketAddress(ip, ntohs(addr.sin_port));
+  return 0;
+}
+
+int TCPSocket::close()
+{
+  if (fd >= 0)
+  {
+    removeSigio(fd);
+    ::close(fd);
+    fd = -1;
+  }
+  // like mbed-os, sockets returned by accept() free themselves on close
+  if (accepted)
+  {
+    delete this;
+  }
+  return 0;
+}
+
+UDPSocket::~UDPSocket()
+{
+  close();
+}
+
+int UDPSocket::open(EthernetInterface *stack)
+{
+  fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+  return fd < 0 ? NSAPI_ERROR_DEVICE_ERROR : NSAPI_ERROR_OK;
+}
+
+int UDPSocket::bind(const char *address, uint16_t port)
+{
+  // The robot's IP does not exist on the host, always serve on loopback instead
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  return ::bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0 ? NSAPI_ERROR_OK
+                                                                            : NSAPI_ERROR_DEVICE_ERROR;
+}
+
+void UDPSocket::set_timeout(int timeout_ms)
+{
+  timeval timeout{};
+  if (timeout_ms >= 0)
+  {
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+  }
+  ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+int UDPSocket::recvfrom(SocketAddress *address, void *data, unsigned size)
+{
+  sockaddr_in addr{};
+  socklen_t len = sizeof(addr);
+  ssize_t n = ::recvfrom(fd, data, size, 0, reinterpret_cast<sockaddr *>(&addr), &len);
+  if (n < 0)
+  {
+    return errno == EAGAIN || errno == EWOULDBLOCK ? NSAPI_ERROR_WOULD_BLOCK : NSAPI_ERROR_DEVICE_ERROR;
+  }
+  if (address)
+  {
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+    *address = SocketAddress(ip, ntohs(addr.sin_port));
+  }
+  return static_cast<int>(n);
+}
+
+int UDPSocket::sendto(const SocketAddress &address, const void *data, unsigned size)
+{
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(address.get_port());
+  inet_pton(AF_INET, address.get_ip_address(), &addr.sin_addr);
+  ssize_t n = ::sendto(fd, data, size, 0, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+  return n < 0 ? NSAPI_ERROR_DEVICE_ERROR : static_cast<int>(n);
+}
+
+int UDPSocket::close()
+{
+  if (fd >= 0)
+  {
+    ::close(fd);
+    fd = -1;
+  }
+  return 0;
+}
+
+namespace sim
+{
+void setPin(PinName pin, int value)
+{
+  std::lock_guard<std::recursive_mutex> irq(interruptLock());
+  std::vector<InterruptIn *> interrupts;
+  {
+    std::lock_guard<std::mutex> lock(pinsMutex());
+    PinState &state = pinState(pin);
+    if (state.value == value)
+    {
+      return;
+    }
+    state.value = value;
+    interrupts = state.interrupts;
+  }
+  for (InterruptIn *interrupt : interrupts)
+  {
+    interrupt->edge(value);
+  }
+}
+
+int getPin(PinName pin)
+{
+  std::lock_guard<std::mutex> lock(pinsMutex());
+  return pinState(pin).value;
+}
+
+void setAnalog(PinName pin, float value)
+{
+  std::lock_guard<std::mutex> lock(pinsMutex());
+  pinState(pin).analog = value;
+}
+
+std::vector<uint8_t> takeSerialBytes(PinName tx)
+{
+  std::lock_guard<std::mutex> lock(pinsMutex());
+  std::vector<uint8_t> bytes;
+  bytes.swap(pinState(tx).serial_bytes);
+  return bytes;
+}
+
+std::recursive_mutex &interruptLock()
+{
+  static std::recursive_mutex lock;
+  return lock;
+}
+}  // namespace sim
+}  // namespace hal
@@ -0,0 +1,463 @@
+#ifndef SIM_HAL_H
+#define SIM_HAL_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "hal/system_stats.h"
+
+/**
+ * Native Linux backend of the HAL, used by the igvc-firmware-sim target.
+ *
+ * It implements the subset of the mbed-os API that the firmware uses on top of std::thread and POSIX
+ * sockets. Pins are held in a global pin table that the simulated world drives through the hal::sim
+ * functions at the bottom of this file. Interrupt handlers (pin edges and tickers) run while holding
+ * the sim interrupt lock, so they are atomic with respect to each other like on the real chip.
+ */
+
+// mbed.h pulls these in through `using namespace std`
+using std::abs;
+using std::max;
+using std::min;
+
+enum PinName
+{
+  p5 = 5, p6, p7, p8, p9, p10, p11, p12, p13, p14, p15, p16, p17, p18, p19, p20,
+  p21, p22, p23, p24, p25, p26, p27, p28, p29, p30,
+  LED1, LED2, LED3, LED4,
+  USBTX, USBRX,
+  PIN_COUNT,
+  NC = -1
+};
+
+enum osPriority_t
+{
+  osPriorityIdle = 1,
+  osPriorityLow = 8,
+  osPriorityBelowNormal = 16,
+  osPriorityNormal = 24,
+  osPriorityAboveNormal = 32,
+  osPriorityHigh = 40,
+  osPriorityRealtime = 48
+};
+
+// nsapi_error_t values returned by the sockets
+enum nsapi_error
+{
+  NSAPI_ERROR_OK = 0,
+  NSAPI_ERROR_WOULD_BLOCK = -3001,
+  NSAPI_ERROR_UNSUPPORTED = -3002,
+  NSAPI_ERROR_DEVICE_ERROR = -3012
+};
+
+// Socket::setsockopt() levels and options
+enum nsapi_socket_level
+{
+  NSAPI_SOCKET = 7000
+};
+
+enum nsapi_socket_option
+{
+  NSAPI_REUSEADDR,
+  NSAPI_KEEPALIVE,
+  NSAPI_KEEPIDLE,
+  NSAPI_KEEPINTVL
+};
+
+// Bytes of queue memory one event takes
+constexpr unsigned EVENTS_EVENT_SIZE = 64;
+
+namespace hal
+{
+template <typename F>
+using Callback = std::function<F>;
+
+template <typename T, typename R, typename... Args>
+Callback<R(Args...)> callback(T *obj, R (T::*method)(Args...))
+{
+  return [obj, method](Args... args) { return (obj->*method)(args...); };
+}
+
+template <typename R, typename... Args>
+Callback<R(Args...)> callback(R (*func)(Args...))
+{
+  return func;
+}
+
+class DigitalOut
+{
+public:
+  explicit DigitalOut(PinName pin, int value = 0);
+  void write(int value);
+  int read();
+  DigitalOut &operator=(int value);
+  operator int();
+
+private:
+  PinName pin;
+};
+
+class DigitalIn
+{
+public:
+  explicit DigitalIn(PinName pin);
+  int read();
+  operator int();
+
+private:
+  PinName pin;
+};
+
+class InterruptIn
+{
+public:
+  explicit InterruptIn(PinName pin);
+  ~InterruptIn();
+  int read();
+  operator int();
+  void rise(Callback<void()> func);
+  void fall(Callback<void()> func);
+  void enable_irq();
+  void disable_irq();
+
+  /* called by the pin table when the pin changes */
+  void edge(int value);
+
+private:
+  PinName pin;
+  Callback<void()> rise_handler;
+  Callback<void()> fall_handler;
+  bool irq_enabled;
+};
+
+class AnalogIn
+{
+public:
+  explicit AnalogIn(PinName pin);
+  float read();
+  unsigned short read_u16();
+
+private:
+  PinName pin;
+};
+
+class SerialBase
+{
+public:
+  enum IrqType
+  {
+    RxIrq = 0,
+    TxIrq
+  };
+
+  SerialBase(PinName tx, PinName rx, int baud);
+  void baud(int baudrate);
+  void attach(Callback<void()> func, IrqType type = RxIrq);
+  int readable();
+  int writeable();
+
+protected:
+  PinName tx;
+  int baudrate;
+  Callback<void()> tx_handler;
+};
+
+/* Bytes written to a RawSerial are captured per TX pin; see sim::takeSerialBytes() */
+class RawSerial : public SerialBase
+{
+public:
+  RawSerial(PinName tx, PinName rx, int baud = 9600);
+  int putc(int c);
+  int getc();
+};
+
+/* The USB serial console prints to stdout */
+class Serial : public SerialBase
+{
+public:
+  Serial(PinName tx, PinName rx, int baud = 9600);
+  int putc(int c);
+  int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Timer
+{
+public:
+  void start();
+  void stop();
+  void reset();
+  float read();
+  int read_ms();
+  int read_us();
+  uint64_t read_high_resolution_us();
+
+private:
+  using Clock = std::chrono::steady_clock;
+  bool running = false;
+  Clock::time_point start_time{};
+  Clock::duration accumulated{};
+  Clock::duration elapsed();
+};
+
+/* Calls its handler from a helper thread, inside the sim interrupt lock */
+class Ticker
+{
+public:
+  Ticker() = default;
+  Ticker(const Ticker &) = delete;
+  Ticker &operator=(const Ticker &) = delete;
+  ~Ticker();
+  void attach_us(Callback<void()> func, uint64_t period_us);
+  void detach();
+
+private:
+  std::thread worker;
+  std::atomic<bool> active{ false };
+};
+
+/* Bytes are captured as soon as they are written, there is no FIFO to flush */
+inline void flushSerialTx(PinName tx)
+{
+}
+
+/* The pin's analog value is sampled whenever it is read, so there is always a fresh result */
+inline void startAdcBurst(PinName pin)
+{
+}
+int readAdcBurst(PinName pin);
+
+/* Flash laid out like the LPC1768's, 512 KB in 4 KB sectors up to 64 KB and 32 KB sectors above. It is kept
+ * in the file named by $IGVC_SIM_FLASH, igvc-sim-flash.bin by default, so it survives restarts. Like real
+ * flash, programming can only clear bits */
+class FlashIAP
+{
+public:
+  int init();
+  int deinit();
+  int read(void *buffer, uint32_t addr, uint32_t size);
+  int program(const void *buffer, uint32_t addr, uint32_t size);
+  int erase(uint32_t addr, uint32_t size);
+  uint32_t get_page_size() const;
+  uint32_t get_sector_size(uint32_t addr) const;
+  uint32_t get_flash_start() const;
+  uint32_t get_flash_size() const;
+
+private:
+  bool inRange(uint32_t addr, uint32_t size) const;
+  int store(uint32_t addr, uint32_t size);
+
+  std::vector<uint8_t> memory;
+  std::string path;
+};
+
+/* Masks "interrupts", i.e. holds the sim interrupt lock while in scope */
+class CriticalSectionLock
+{
+public:
+  CriticalSectionLock();
+  ~CriticalSectionLock();
+  CriticalSectionLock(const CriticalSectionLock &) = delete;
+  CriticalSectionLock &operator=(const CriticalSectionLock &) = delete;
+};
+
+/* rtos::Mutex is recursive */
+class Mutex
+{
+public:
+  void lock();
+  void unlock();
+  bool trylock();
+
+private:
+  std::recursive_mutex mutex;
+};
+
+struct ThreadFlags
+{
+  std::mutex mutex;
+  std::condition_variable changed;
+  uint32_t flags = 0;
+};
+
+class Thread
+{
+public:
+  explicit Thread(osPriority_t priority = osPriorityNormal, uint32_t stack_size = 0,
+                  unsigned char *stack_mem = nullptr, const char *name = nullptr);
+  Thread(const Thread &) = delete;
+  Thread &operator=(const Thread &) = delete;
+  int start(Callback<void()> task);
+  int32_t flags_set(uint32_t flags);
+
+private:
+  std::shared_ptr<ThreadFlags> thread_flags;
+};
+
+namespace ThisThread
+{
+uint32_t flags_wait_any(uint32_t flags, bool clear = true);
+uint32_t flags_wait_any_for(uint32_t flags, uint32_t millisec, bool clear = true);
+void sleep_for(uint32_t millisec);
+}  // namespace ThisThread
+
+void wait_ms(int ms);
+
+/* Calls queued functions on the thread that dispatches the queue. Like on mbed, the size bounds how many
+ * events can be pending at once */
+class EventQueue
+{
+public:
+  explicit EventQueue(unsigned size = 32 * EVENTS_EVENT_SIZE, unsigned char *buffer = nullptr);
+  EventQueue(const EventQueue &) = delete;
+  EventQueue &operator=(const EventQueue &) = delete;
+
+  /* @return an id, or 0 if the queue is full. Safe to call from any thread */
+  template <typename F>
+  int call(F f)
+  {
+    return post(std::function<void()>(std::move(f)), 0);
+  }
+
+  /* Calls f every period_ms, the first time period_ms from now */
+  template <typename F>
+  int call_every(int period_ms, F f)
+  {
+    return post(std::function<void()>(std::move(f)), period_ms);
+  }
+
+  void dispatch_forever();
+
+private:
+  using Clock = std::chrono::steady_clock;
+  struct Event
+  {
+    Clock::time_point due;
+    int period_ms;
+    std::function<void()> func;
+  };
+
+  int post(std::function<void()> func, int period_ms);
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::vector<Event> events;
+  size_t capacity;
+  int next_id = 1;
+};
+
+/* Monotonic microseconds since the sim started */
+uint64_t readMicros();
+
+/* There is no cycle counter on the host, these count nanoseconds instead */
+void enableCycleCounter();
+uint32_t cycleCount();
+
+/* Only the uptime is known on the host; cycles_per_us is 1000 to match cycleCount() */
+void readSystemStats(SystemStats &stats);
+
+/* A starved watchdog ends the sim process, there is nothing to reset. Calling it again changes the timeout */
+void startWatchdog(uint32_t timeout_ms);
+void feedWatchdog();
+/* Always POWER_ON */
+ResetReason readResetReason();
+
+/* Network stack: sockets are plain POSIX sockets bound to the loopback interface */
+class EthernetInterface
+{
+public:
+  int set_network(const char *ip_address, const char *netmask, const char *gateway);
+  int connect();
+  const char *get_ip_address();
+};
+
+class SocketAddress
+{
+public:
+  explicit SocketAddress(const char *ip = nullptr, uint16_t port = 0);
+  const char *get_ip_address() const;
+  uint16_t get_port() const;
+
+private:
+  std::string ip;
+  uint16_t port;
+};
+
+bool operator==(const SocketAddress &a, const SocketAddress &b);
+bool operator!=(const SocketAddress &a, const SocketAddress &b);
+
+class TCPSocket
+{
+public:
+  TCPSocket() = default;
+  TCPSocket(const TCPSocket &) = delete;
+  TCPSocket &operator=(const TCPSocket &) = delete;
+  ~TCPSocket();
+  int open(EthernetInterface *stack);
+  int bind(const char *address, uint16_t port);
+  int listen(int backlog = 1);
+  TCPSocket *accept(int *error = nullptr);
+  /* a negative timeout blocks forever */
+  void set_timeout(int timeout_ms);
+  void set_blocking(bool blocking);
+  /* func is called from the sim network thread whenever the socket becomes readable, including when a
+   * connection is waiting to be accepted or the peer closed */
+  void sigio(Callback<void()> func);
+  /* Supports the keepalive options of level NSAPI_SOCKET, in milliseconds like lwIP */
+  int setsockopt(int level, int optname, const void *optval, unsigned optlen);
+  int recv(void *data, unsigned size);
+  int send(const void *data, unsigned size);
+  int getpeername(SocketAddress *address);
+  int close();
+
+private:
+  int fd = -1;
+  bool accepted = false;
+};
+
+class UDPSocket
+{
+public:
+  UDPSocket() = default;
+  UDPSocket(const UDPSocket &) = delete;
+  UDPSocket &operator=(const UDPSocket &) = delete;
+  ~UDPSocket();
+  int open(EthernetInterface *stack);
+  int bind(const char *address, uint16_t port);
+  /* a negative timeout blocks forever */
+  void set_timeout(int timeout_ms);
+  int recvfrom(SocketAddress *address, void *data, unsigned size);
+  int sendto(const SocketAddress &address, const void *data, unsigned size);
+  int close();
+
+private:
+  int fd = -1;
+};
+
+namespace sim
+{
+/* Drive an input pin. Edges are dispatched to InterruptIn handlers like a GPIO interrupt would be. */
+void setPin(PinName pin, int value);
+int getPin(PinName pin);
+void setAnalog(PinName pin, float value);
+
+/* Removes and returns every byte written to the serial port with the given TX pin since the last call */
+std::vector<uint8_t> takeSerialBytes(PinName tx);
+
+/* Lock held while interrupt handlers run */
+std::recursive_mutex &interruptLock();
+}  // namespace sim
+}  // namespace hal
+
+#endif  // SIM_HAL_H
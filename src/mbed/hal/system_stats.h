@@ -0,0 +1,44 @@
+#ifndef SYSTEM_STATS_H
+#define SYSTEM_STATS_H
+
+#include <cstdint>
+
+namespace hal
+{
+constexpr int MAX_THREAD_STATS = 8;
+
+/* Why the chip last reset */
+enum class ResetReason
+{
+  UNKNOWN,  // none of the reset flags is set, e.g. after a software or debugger reset
+  POWER_ON,
+  EXTERNAL,  // the reset pin
+  WATCHDOG,
+  BROWN_OUT
+};
+
+struct ThreadStackStats
+{
+  const char *name;
+  uint32_t stack_size;
+  uint32_t stack_free;  // bytes of the stack never touched so far
+};
+
+/* Runtime statistics collected by the OS (the platform.*-stats-enabled options in mbed_app.json) */
+struct SystemStats
+{
+  uint64_t uptime_us = 0;
+  uint64_t idle_us = 0;
+  uint64_t sleep_us = 0;
+  uint32_t heap_current = 0;
+  uint32_t heap_max = 0;
+  uint32_t heap_reserved = 0;
+  uint32_t heap_alloc_fail = 0;
+  uint32_t os_version = 0;
+  uint32_t cycles_per_us = 0;
+  int thread_count = 0;
+  ThreadStackStats threads[MAX_THREAD_STATS]{};
+};
+}  // namespace hal
+
+#endif  // SYSTEM_STATS_H
@@ -85,12 +85,12 @@
 #define MBED_CONF_LWIP_L3IP_ENABLED                                           0                                                                                                // set by library:lwip
 #define MBED_CONF_LWIP_MEM_SIZE                                               16362                                                                                            // set by library:lwip[LPC1768]
 #define MBED_CONF_LWIP_PPP_THREAD_STACKSIZE                                   768                                                                                              // set by library:lwip
-#define MBED_CONF_LWIP_SOCKET_MAX                                             4                                                                                                // set by library:lwip
+#define MBED_CONF_LWIP_SOCKET_MAX                                             6                                                                                                // set by application[*]
 #define MBED_CONF_LWIP_TCPIP_THREAD_STACKSIZE                                 1200                                                                                             // set by library:lwip
 #define MBED_CONF_LWIP_TCP_ENABLED                                            1                                                                                                // set by library:lwip
 #define MBED_CONF_LWIP_TCP_MAXRTX                                             6                                                                                                // set by library:lwip
 #define MBED_CONF_LWIP_TCP_SERVER_MAX                                         4                                                                                                // set by library:lwip
-#define MBED_CONF_LWIP_TCP_SOCKET_MAX                                         4                                                                                                // set by library:lwip
+#define MBED_CONF_LWIP_TCP_SOCKET_MAX                                         6                                                                                                // set by application[*]
 #define MBED_CONF_LWIP_UDP_SOCKET_MAX                                         4                                                                                                // set by library:lwip
 #define MBED_CONF_LWIP_USE_MBED_TRACE                                         0                                                                                                // set by library:lwip
 #define MBED_CONF_MBED_MESH_API_6LOWPAN_ND_CHANNEL                            0                                                                                                // set by library:mbed-mesh-api
@@ -0,0 +1,108 @@
+#include "odometry/odometry.h"
+
+#include <cmath>
+
+#include "utils.h"
+
+namespace
+{
+constexpr float PI = 3.14159265f;
+constexpr float METERS_PER_TICK_F = static_cast<float>(METERS_PER_TICK);
+// float rounding slowly shrinks or grows the heading vector, pull it back to unit length every so often
+constexpr uint32_t NORMALIZE_INTERVAL = 64;
+}  // namespace
+
+Odometry::Odometry(float wheel_base)
+  : wheel_base(wheel_base), heading_cos(1.0f), heading_sin(0.0f), updates_since_normalize(0)
+{
+}
+
+/*
+Integrate one control tick.
+@param[in] left_ticks, right_ticks encoder deltas since the last update
+*/
+void Odometry::update(int32_t left_ticks, int32_t right_ticks)
+{
+  if (left_ticks == 0 && right_ticks == 0)
+  {
+    return;
+  }
+
+  float d_left = METERS_PER_TICK_F * static_cast<float>(left_ticks);
+  float d_right = METERS_PER_TICK_F * static_cast<float>(right_ticks);
+  float d_center = 0.5f * (d_left + d_right);
+  float d_theta = (d_right - d_left) / wheel_base;
+
+  // heading half way through the step
+  float mid_cos = heading_cos;
+  float mid_sin = heading_sin;
+  rotate(mid_cos, mid_sin, 0.5f * d_theta);
+
+  pose.x += d_center * mid_cos;
+  pose.y += d_center * mid_sin;
+  pose.distance += d_center < 0.0f ? -d_center : d_center;
+
+  rotate(heading_cos, heading_sin, d_theta);
+  pose.theta += d_theta;
+  if (pose.theta > PI)
+  {
+    pose.theta -= 2.0f * PI;
+  }
+  else if (pose.theta < -PI)
+  {
+    pose.theta += 2.0f * PI;
+  }
+
+  if (++updates_since_normalize >= NORMALIZE_INTERVAL)
+  {
+    // one Newton step of 1/sqrt(n) around n = 1
+    float scale = 0.5f * (3.0f - (heading_cos * heading_cos + heading_sin * heading_sin));
+    heading_cos *= scale;
+    heading_sin *= scale;
+    updates_since_normalize = 0;
+  }
+}
+
+void Odometry::setWheelBase(float wheel_base)
+{
+  this->wheel_base = wheel_base;
+}
+
+/*
+Overwrite the pose, e.g. from the host's localization. The distance travelled is kept.
+*/
+void Odometry::setPose(float x, float y, float theta)
+{
+  pose.x = x;
+  pose.y = y;
+  pose.theta = std::remainder(theta, 2.0f * PI);
+  heading_cos = std::cos(pose.theta);
+  heading_sin = std::sin(pose.theta);
+  updates_since_normalize = 0;
+}
+
+void Odometry::reset()
+{
+  setPose(0.0f, 0.0f, 0.0f);
+  pose.distance = 0.0f;
+}
+
+Pose Odometry::getPose() const
+{
+  return pose;
+}
+
+/*
+Rotate the vector (c, s) by a small angle, using cos(a) ~ 1 - a^2/2 and sin(a) ~ a - a^3/6.
+At the largest per-tick angles the robot can reach (~0.02 rad) the truncation error is ~1e-8, below
+float resolution.
+*/
+void Odometry::rotate(float &c, float &s, float angle)
+{
+  float angle_sq = angle * angle;
+  float cos_a = 1.0f - 0.5f * angle_sq;
+  float sin_a = angle * (1.0f - angle_sq / 6.0f);
+  float new_c = c * cos_a - s * sin_a;
+  s = s * cos_a + c * sin_a;
+  c = new_c;
+}
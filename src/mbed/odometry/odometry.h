@@ -0,0 +1,42 @@
+#ifndef ODOMETRY_H
+#define ODOMETRY_H
+
+#include <cstdint>
+
+struct Pose
+{
+  float x = 0.0f;         // m
+  float y = 0.0f;         // m
+  float theta = 0.0f;     // rad, wrapped to [-pi, pi]
+  float distance = 0.0f;  // m travelled by the robot's centre, always increasing
+};
+
+/**
+ * Differential drive dead reckoning, integrated from the raw encoder deltas every control tick.
+ *
+ * Integration is second order (the heading at the middle of the step is used). The heading is kept as
+ * a unit vector that is rotated by a short series expansion of the small per-tick angle, so that no
+ * trigonometric function is evaluated in the control loop.
+ */
+class Odometry
+{
+public:
+  explicit Odometry(float wheel_base);
+  void update(int32_t left_ticks, int32_t right_ticks);
+  /* Applies to the ticks from now on, the pose so far is kept */
+  void setWheelBase(float wheel_base);
+  void setPose(float x, float y, float theta);
+  void reset();
+  Pose getPose() const;
+
+private:
+  float wheel_base;
+  Pose pose;
+  float heading_cos;
+  float heading_sin;
+  uint32_t updates_since_normalize;
+
+  static void rotate(float &c, float &s, float angle);
+};
+
+#endif  // ODOMETRY_H
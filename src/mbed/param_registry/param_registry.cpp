@@ -0,0 +1,157 @@
+#include "param_registry/param_registry.h"
+
+#include <cstring>
+
+#include "utils.h"
+
+namespace
+{
+float toFloat(uint32_t word)
+{
+  float value;
+  memcpy(&value, &word, sizeof value);
+  return value;
+}
+
+uint32_t toWord(float value)
+{
+  uint32_t word;
+  memcpy(&word, &value, sizeof word);
+  return word;
+}
+
+constexpr float MAX_GAIN = 1000.0f;
+}  // namespace
+
+/* In ParamId order */
+const ParamRegistry::Info ParamRegistry::INFO[PARAM_COUNT] = {
+  { Type::FLOAT, 0.0f, 0.0f, MAX_GAIN },  // p_l
+  { Type::FLOAT, 0.0f, 0.0f, MAX_GAIN },  // p_r
+  { Type::FLOAT, 0.0f, 0.0f, MAX_GAIN },  // i_l
+  { Type::FLOAT, 0.0f, 0.0f, MAX_GAIN },  // i_r
+  { Type::FLOAT, 0.0f, 0.0f, MAX_GAIN },  // d_l
+  { Type::FLOAT, 0.0f, 0.0f, MAX_GAIN },  // d_r
+  { Type::FLOAT, 0.0f, 0.0f, MAX_GAIN },  // kv_l
+  { Type::FLOAT, 0.0f, 0.0f, MAX_GAIN },  // kv_r
+  { Type::FLOAT, PID_DERIVATIVE_ALPHA, 0.0f, 1.0f },
+  { Type::FLOAT, PID_INTEGRAL_CLAMP, 0.0f, static_cast<float>(MOTOR_COMMAND_LIMIT) },  // see clampCommand()
+  { Type::FLOAT, PID_DEADBAND, 0.0f, 1.0f },
+  { Type::UINT, COMMAND_TIMEOUT_MS, 1.0f, 60000.0f },
+  { Type::FLOAT, 0.0f, 0.0f, MAX_GAIN },  // ka_l
+  { Type::FLOAT, 0.0f, 0.0f, MAX_GAIN },  // ka_r
+  { Type::FLOAT, PI_BACK_CALC_GAIN, 0.0f, 1000.0f },
+  { Type::UINT, ControllerType_CONTROLLER_PID, 0.0f, ControllerType_CONTROLLER_LQR },  // controller_l
+  { Type::UINT, ControllerType_CONTROLLER_PID, 0.0f, ControllerType_CONTROLLER_LQR },  // controller_r
+  { Type::FLOAT, TRAJECTORY_ACCEL_LIMIT, 0.0f, 20.0f },
+  { Type::FLOAT, TRAJECTORY_JERK_LIMIT, 0.0f, 1000.0f },
+  { Type::FLOAT, TWIST_MAX_WHEEL_SPEED, 0.0f, 10.0f },
+  { Type::FLOAT, TWIST_LINEAR_ACCEL, 0.0f, 20.0f },
+  { Type::FLOAT, TWIST_ANGULAR_ACCEL, 0.0f, 50.0f },
+  { Type::FLOAT, WHEEL_BASE, 0.1f, 5.0f },
+};
+
+ParamRegistry::ParamRegistry()
+{
+  reset();
+}
+
+void ParamRegistry::reset()
+{
+  for (int i = 0; i < PARAM_COUNT; ++i)
+  {
+    values[i] = defaultWord(static_cast<ParamId>(i));
+  }
+}
+
+bool ParamRegistry::set(const Param &param)
+{
+  if (param.id < 0 || param.id >= PARAM_COUNT)
+  {
+    return false;
+  }
+  if (INFO[param.id].type == Type::FLOAT)
+  {
+    return param.has_float_value && setFloat(param.id, param.float_value);
+  }
+  return param.has_uint_value && setUint(param.id, param.uint_value);
+}
+
+bool ParamRegistry::setFloat(ParamId id, float value)
+{
+  if (INFO[id].type != Type::FLOAT || !isValid(id, toWord(value)))
+  {
+    return false;
+  }
+  values[id] = toWord(value);
+  return true;
+}
+
+bool ParamRegistry::setUint(ParamId id, uint32_t value)
+{
+  if (INFO[id].type != Type::UINT || !isValid(id, value))
+  {
+    return false;
+  }
+  values[id] = value;
+  return true;
+}
+
+float ParamRegistry::getFloat(ParamId id) const
+{
+  return toFloat(values[id]);
+}
+
+uint32_t ParamRegistry::getUint(ParamId id) const
+{
+  return values[id];
+}
+
+Param ParamRegistry::get(ParamId id) const
+{
+  Param param = Param_init_zero;
+  param.id = id;
+  if (INFO[id].type == Type::FLOAT)
+  {
+    param.has_float_value = true;
+    param.float_value = getFloat(id);
+  }
+  else
+  {
+    param.has_uint_value = true;
+    param.uint_value = getUint(id);
+  }
+  return param;
+}
+
+const uint32_t *ParamRegistry::words() const
+{
+  return values;
+}
+
+bool ParamRegistry::loadWords(const uint32_t *words, int count)
+{
+  count = count < PARAM_COUNT ? count : PARAM_COUNT;
+  for (int i = 0; i < count; ++i)
+  {
+    if (!isValid(static_cast<ParamId>(i), words[i]))
+    {
+      return false;
+    }
+  }
+  memcpy(values, words, count * sizeof(uint32_t));
+  return true;
+}
+
+bool ParamRegistry::isValid(ParamId id, uint32_t word)
+{
+  const Info &info = INFO[id];
+  // written so that NaN fails too
+  float value = info.type == Type::FLOAT ? toFloat(word) : static_cast<float>(word);
+  return value >= info.min && value <= info.max;
+}
+
+uint32_t ParamRegistry::defaultWord(ParamId id)
+{
+  const Info &info = INFO[id];
+  return info.type == Type::FLOAT ? toWord(info.default_value) : static_cast<uint32_t>(info.default_value);
+}
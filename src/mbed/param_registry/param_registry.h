@@ -0,0 +1,66 @@
+#ifndef PARAM_REGISTRY_H
+#define PARAM_REGISTRY_H
+
+#include <cstdint>
+
+#include "igvc.pb.h"
+
+/**
+ * Typed table of the tunable parameters (see ParamId in the proto) with their defaults and valid ranges.
+ *
+ * Every parameter is either a float or a uint32 and is held as its raw 32 bits, indexed by ParamId, so the
+ * whole table can be written to flash as it is (see ParamStore). Values of the wrong type or out of range
+ * are refused, so whatever the registry holds is safe to apply to the control loop.
+ */
+class ParamRegistry
+{
+public:
+  static constexpr int PARAM_COUNT = ParamId_PARAM_WHEEL_BASE + 1;
+
+  enum class Type
+  {
+    FLOAT,
+    UINT
+  };
+
+  ParamRegistry();
+  /* Restores every default */
+  void reset();
+
+  /* @return false, changing nothing, for an unknown id, the wrong type or a value out of range */
+  bool set(const Param &param);
+  bool setFloat(ParamId id, float value);
+  bool setUint(ParamId id, uint32_t value);
+
+  float getFloat(ParamId id) const;
+  uint32_t getUint(ParamId id) const;
+  /* the value in the field of its type */
+  Param get(ParamId id) const;
+
+  /* the raw values, PARAM_COUNT words */
+  const uint32_t *words() const;
+  /*
+  Replaces the values with raw ones, e.g. from flash. Parameters past count keep their value, so a table saved
+  before parameters were appended still loads.
+  @return false, changing nothing, if any of the words is not a valid value
+  */
+  bool loadWords(const uint32_t *words, int count);
+
+private:
+  struct Info
+  {
+    Type type;
+    float default_value;
+    float min;
+    float max;
+  };
+
+  static const Info INFO[PARAM_COUNT];
+
+  static bool isValid(ParamId id, uint32_t word);
+  static uint32_t defaultWord(ParamId id);
+
+  uint32_t values[PARAM_COUNT];
+};
+
+#endif  // PARAM_REGISTRY_H
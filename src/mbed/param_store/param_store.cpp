@@ -0,0 +1,174 @@
+#include "param_store/param_store.h"
+
+#include <cstddef>
+#include <cstring>
+
+bool ParamStore::init()
+{
+  if (flash.init() != 0)
+  {
+    return false;
+  }
+  uint32_t end = flash.get_flash_start() + flash.get_flash_size();
+  sector_address[1] = end - flash.get_sector_size(end - 1);
+  sector_address[0] = sector_address[1] - flash.get_sector_size(sector_address[1] - 1);
+  uint32_t sector_size = flash.get_sector_size(sector_address[1]);
+  uint32_t page_size = flash.get_page_size();
+  if (flash.get_sector_size(sector_address[0]) != sector_size || page_size > RECORD_SIZE ||
+      RECORD_SIZE % page_size != 0)
+  {
+    return false;
+  }
+  records_per_sector = sector_size / RECORD_SIZE;
+
+  Record record;
+  int newest_sector = 0;
+  uint32_t newest_slot = 0;
+  for (int sector = 0; sector < 2; ++sector)
+  {
+    for (uint32_t slot = 0; slot < records_per_sector; ++slot)
+    {
+      uint32_t address = slotAddress(sector, slot);
+      if (readRecord(address, record) &&
+          (!has_newest || static_cast<int32_t>(record.sequence - newest_sequence) > 0))
+      {
+        has_newest = true;
+        newest_address = address;
+        newest_sequence = record.sequence;
+        newest_sector = sector;
+        newest_slot = slot;
+      }
+    }
+  }
+
+  /* The next record goes into the first erased slot after the newest one. Slots in between hold records
+   * whose save was cut short */
+  next_sector = newest_sector;
+  next_slot = has_newest ? newest_slot + 1 : 0;
+  while (next_slot < records_per_sector && !isErased(slotAddress(next_sector, next_slot)))
+  {
+    ++next_slot;
+  }
+  if (next_slot == records_per_sector)
+  {
+    next_sector = 1 - next_sector;
+    next_slot = 0;
+    next_needs_erase = true;
+  }
+
+  initialized = true;
+  return true;
+}
+
+ParamStore::Result ParamStore::load(ParamRegistry &registry)
+{
+  if (!initialized)
+  {
+    return Result::ERROR;
+  }
+  Record record;
+  if (!has_newest || !readRecord(newest_address, record) || record.version != LAYOUT_VERSION)
+  {
+    return Result::NOT_FOUND;
+  }
+  return registry.loadWords(record.words, record.word_count) ? Result::OK : Result::ERROR;
+}
+
+ParamStore::Result ParamStore::save(const ParamRegistry &registry)
+{
+  if (!initialized)
+  {
+    return Result::ERROR;
+  }
+
+  Record record;
+  memset(&record, 0xFF, sizeof record);
+  record.magic = MAGIC;
+  record.sequence = has_newest ? newest_sequence + 1 : 0;
+  record.version = LAYOUT_VERSION;
+  record.word_count = ParamRegistry::PARAM_COUNT;
+  memcpy(record.words, registry.words(), ParamRegistry::PARAM_COUNT * sizeof(uint32_t));
+  record.crc = crc32(&record, offsetof(Record, crc));
+
+  int sector = next_sector;
+  uint32_t address = slotAddress(next_sector, next_slot);
+  if (next_needs_erase && flash.erase(sector_address[sector], records_per_sector * RECORD_SIZE) != 0)
+  {
+    return Result::ERROR;
+  }
+  next_needs_erase = false;
+
+  // a failed slot is skipped by the next save as well
+  advance();
+  Record written;
+  if (flash.program(&record, address, RECORD_SIZE) != 0 || !readRecord(address, written) ||
+      written.sequence != record.sequence)
+  {
+    return Result::ERROR;
+  }
+  has_newest = true;
+  newest_address = address;
+  newest_sequence = record.sequence;
+  return Result::OK;
+}
+
+bool ParamStore::saveNeedsErase() const
+{
+  return next_needs_erase;
+}
+
+uint32_t ParamStore::crc32(const void *data, uint32_t size)
+{
+  // reflected CRC-32 (IEEE 802.3), four bits at a time to keep the table small
+  static const uint32_t TABLE[16] = { 0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4,
+                                      0x4db26158, 0x5005713c, 0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+                                      0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c };
+  const auto *bytes = static_cast<const uint8_t *>(data);
+  uint32_t crc = 0xFFFFFFFF;
+  for (uint32_t i = 0; i < size; ++i)
+  {
+    crc ^= bytes[i];
+    crc = (crc >> 4) ^ TABLE[crc & 0xF];
+    crc = (crc >> 4) ^ TABLE[crc & 0xF];
+  }
+  return ~crc;
+}
+
+bool ParamStore::readRecord(uint32_t address, Record &record)
+{
+  return flash.read(&record, address, RECORD_SIZE) == 0 && record.magic == MAGIC &&
+         record.word_count <= MAX_WORDS && record.crc == crc32(&record, offsetof(Record, crc));
+}
+
+bool ParamStore::isErased(uint32_t address)
+{
+  uint32_t words[RECORD_SIZE / 4];
+  if (flash.read(words, address, RECORD_SIZE) != 0)
+  {
+    return false;
+  }
+  for (uint32_t word : words)
+  {
+    if (word != 0xFFFFFFFF)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint32_t ParamStore::slotAddress(int sector, uint32_t slot) const
+{
+  return sector_address[sector] + slot * RECORD_SIZE;
+}
+
+/* Moves on to the next slot, and to the other sector once this one is full */
+void ParamStore::advance()
+{
+  if (++next_slot == records_per_sector)
+  {
+    next_sector = 1 - next_sector;
+    next_slot = 0;
+    next_needs_erase = true;
+  }
+}
@@ -0,0 +1,80 @@
+#ifndef PARAM_STORE_H
+#define PARAM_STORE_H
+
+#include <cstdint>
+
+#include "hal/hal.h"
+#include "param_registry/param_registry.h"
+
+/**
+ * Keeps the ParamRegistry in the last two sectors of the on-chip flash.
+ *
+ * Every save appends a one-page record (magic, sequence number, layout version, the raw words and a CRC-32)
+ * to the current sector. When that is full the other sector is erased and written instead. At boot the valid
+ * record with the highest sequence number wins, so a save cut short by a reset leaves the previous record in
+ * place and the firmware always boots into the last configuration that was saved completely.
+ *
+ * Programming a record takes about a millisecond, but the erase needed whenever a sector is full (every 128
+ * saves with the 32 KB sectors) stalls the chip with interrupts off for ~100 ms, see saveNeedsErase(). The
+ * firmware image must stay clear of the two sectors, which leaves it the first 448 KB of the LPC1768; the
+ * link script is limited to that, see MBED_ROM_SIZE in src/mbed/CMakeLists.txt.
+ */
+class ParamStore
+{
+public:
+  /* Bump when the meaning of existing words changes; appending parameters needs no new version */
+  static constexpr uint16_t LAYOUT_VERSION = 1;
+
+  enum class Result
+  {
+    OK,
+    NOT_FOUND,
+    ERROR
+  };
+
+  /* Finds the newest record and where the next one goes. Until it succeeded, load() and save() fail */
+  bool init();
+  /* Loads the newest valid record. Anything but OK leaves registry as it was */
+  Result load(ParamRegistry &registry);
+  Result save(const ParamRegistry &registry);
+  /* whether the next save() has to erase a sector first */
+  bool saveNeedsErase() const;
+
+private:
+  static constexpr uint32_t RECORD_SIZE = 256;
+  static constexpr uint32_t MAGIC = 0x50524d31;  // "PRM1"
+  static constexpr int MAX_WORDS = (RECORD_SIZE - 16) / 4;
+  static_assert(ParamRegistry::PARAM_COUNT <= MAX_WORDS, "the parameters don't fit in one record");
+
+  struct Record
+  {
+    uint32_t magic;
+    uint32_t sequence;
+    uint16_t version;
+    uint16_t word_count;
+    uint32_t words[MAX_WORDS];
+    uint32_t crc;  // of everything before it
+  };
+  static_assert(sizeof(Record) == RECORD_SIZE, "a record must be exactly one flash page");
+
+  static uint32_t crc32(const void *data, uint32_t size);
+  bool readRecord(uint32_t address, Record &record);
+  bool isErased(uint32_t address);
+  uint32_t slotAddress(int sector, uint32_t slot) const;
+  void advance();
+
+  hal::FlashIAP flash;
+  bool initialized = false;
+  uint32_t sector_address[2] = {};
+  uint32_t records_per_sector = 0;
+
+  bool has_newest = false;
+  uint32_t newest_address = 0;
+  uint32_t newest_sequence = 0;
+  // where the next record goes, and whether that sector has to be erased first
+  int next_sector = 0;
+  uint32_t next_slot = 0;
+  bool next_needs_erase = false;
+};
+
+#endif  // PARAM_STORE_H
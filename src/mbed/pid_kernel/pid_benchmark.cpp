@@ -0,0 +1,51 @@
+#include "pid_kernel/pid_benchmark.h"
+
+#include "pid_kernel/pid_kernel.h"
+#include "wheel_controller/wheel_controller.h"
+
+namespace
+{
+constexpr int BENCHMARK_ITERATIONS = 1000;
+
+template <typename T>
+uint32_t measureCyclesPerIteration(ControllerType type)
+{
+  PIDCoeffs coeffs;
+  coeffs.k_p = 40.0f;
+  coeffs.k_i = 5.0f;
+  coeffs.k_d = 0.5f;
+  coeffs.k_kv = 25.0f;
+  coeffs.k_a = 2.0f;
+
+  WheelController<T> kernel;
+  kernel.setCoeffs(coeffs);
+  kernel.select(type);
+  const T desired_speed(1.0f);
+  const ControlTiming<T> timing = ControlTiming<T>::fromPeriod(CONTROL_PERIOD_US);
+
+  // volatile so the loop is not optimized away
+  volatile int sink = 0;
+  uint32_t start = hal::cycleCount();
+  for (int i = 0; i < BENCHMARK_ITERATIONS; ++i)
+  {
+    T actual_speed = speedFromTicks<T>(i % 16, CONTROL_PERIOD_US);
+    sink = kernel.update(desired_speed, actual_speed, timing);
+  }
+  uint32_t cycles = hal::cycleCount() - start;
+  static_cast<void>(sink);
+  return cycles / BENCHMARK_ITERATIONS;
+}
+}  // namespace
+
+void benchmarkControllers(hal::Serial &pc)
+{
+  static const char *const NAMES[] = { "PID", "PI back-calc", "feedforward", "LQR" };
+  hal::enableCycleCounter();
+  for (int type = ControllerType_CONTROLLER_PID; type <= ControllerType_CONTROLLER_LQR; ++type)
+  {
+    uint32_t float_cycles = measureCyclesPerIteration<float>(static_cast<ControllerType>(type));
+    uint32_t fixed_cycles = measureCyclesPerIteration<Q16_16>(static_cast<ControllerType>(type));
+    pc.printf("%s controller cycles/iteration: float %lu, Q16.16 %lu\r\n", NAMES[type],
+              static_cast<unsigned long>(float_cycles), static_cast<unsigned long>(fixed_cycles));
+  }
+}
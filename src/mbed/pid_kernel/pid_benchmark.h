@@ -0,0 +1,13 @@
+#ifndef PID_BENCHMARK_H
+#define PID_BENCHMARK_H
+
+#include "hal/hal.h"
+
+/**
+ * Runs every control law of WheelController, in its float and its Q16.16 instantiation, on the same
+ * synthetic input and prints the mean cycle count of one iteration (speed conversion plus update(), i.e.
+ * one wheel) of each. On the sim backend the "cycles" are nanoseconds.
+ */
+void benchmarkControllers(hal::Serial &pc);
+
+#endif  // PID_BENCHMARK_H
@@ -0,0 +1,177 @@
+#ifndef PID_KERNEL_H
+#define PID_KERNEL_H
+
+#include <cstdint>
+#include <type_traits>
+
+#include "fixed_point/fixed_point.h"
+#include "utils.h"
+
+/**
+ * Velocity PID kernel of one wheel, templated on its scalar type so the same control law can run in
+ * float or in fixed-point (see ControlScalar in utils.h).
+ *
+ * https://en.wikipedia.org/wiki/PID_controller#Discrete_implementation but with e(t) on velocity, not
+ * position. Changes to before 1: Derivative on PV 2: Corrected integral 3: Low pass on Derivative
+ * 4: Clamping on Integral 5: Feed forward
+ */
+
+/* Length of one control period, and its inverse, in the kernel's scalar type */
+template <typename T>
+struct ControlTiming
+{
+  T d_t_sec;
+  T rate_hz;
+
+  static ControlTiming fromPeriod(int32_t period_us)
+  {
+    if constexpr (std::is_floating_point<T>::value)
+    {
+      return { static_cast<T>(period_us) * T(1e-6), T(1e6) / static_cast<T>(period_us) };
+    }
+    else
+    {
+      return { T::fromRatio(period_us, 1000000), T::fromRatio(1000000, period_us) };
+    }
+  }
+};
+
+/* Wheel speed in m/s from the ticks counted during one control period */
+template <typename T>
+T speedFromTicks(int32_t ticks, int32_t period_us)
+{
+  if constexpr (std::is_floating_point<T>::value)
+  {
+    return static_cast<T>(METERS_PER_TICK * 1e6) * static_cast<T>(ticks) / static_cast<T>(period_us);
+  }
+  else
+  {
+    constexpr int64_t picometers_per_tick = static_cast<int64_t>(METERS_PER_TICK * 1e12 + 0.5);
+    return T::fromRatio(ticks * picometers_per_tick, static_cast<int64_t>(period_us) * 1000000);
+  }
+}
+
+/* The motor command limited to what the Sabertooth accepts */
+template <typename T>
+T clampCommand(T command)
+{
+  const T limit(static_cast<float>(MOTOR_COMMAND_LIMIT));
+  return command > limit ? limit : (command < -limit ? -limit : command);
+}
+
+/* 8: No command while both the setpoint and the speed are inside the deadband, so a parked wheel doesn't creep */
+template <typename T>
+int applyDeadband(int signal, T desired_speed, T actual_speed, T deadband)
+{
+  return absolute(actual_speed) < deadband && absolute(desired_speed) < deadband ? 0 : signal;
+}
+
+template <typename T>
+class PidKernel
+{
+public:
+  /* Converts the gains to T once, so that update() never touches float */
+  void setCoeffs(const PIDCoeffs &coeffs)
+  {
+    k_p = T(coeffs.k_p);
+    k_i = T(coeffs.k_i);
+    k_d = T(coeffs.k_d);
+    k_kv = T(coeffs.k_kv);
+    k_i_float = coeffs.k_i;
+    updateIntegralClamp();
+  }
+
+  void setTuning(const PidTuning &tuning)
+  {
+    alpha = T(tuning.derivative_alpha);
+    one_minus_alpha = T(1.0f - tuning.derivative_alpha);
+    deadband = T(tuning.deadband);
+    integral_clamp = tuning.integral_clamp;
+    updateIntegralClamp();
+  }
+
+  void resetIntegral()
+  {
+    i_error = T();
+  }
+
+  /*
+  Starts over from the current speeds, as if the wheel had been at actual_speed for a while. The integral is
+  set so that the output carries on from command, within the clamp; without an integral term it can't be
+  @param[in] command the last command of the law this one takes over from
+  */
+  void reset(T desired_speed, T actual_speed, T command)
+  {
+    low_passed_pv = T();
+    actual_speed_last = actual_speed;
+    i_error = T();
+    if (has_i_clamp)
+    {
+      T error = desired_speed - actual_speed;
+      i_error = (command - k_kv * desired_speed - k_p * error) / k_i;
+      i_error = i_error > i_clamp ? i_clamp : (i_error < -i_clamp ? -i_clamp : i_error);
+    }
+  }
+
+  /*
+  Runs one iteration of the control law.
+  @return the motor command, before the Sabertooth's own clamping
+  */
+  int update(T desired_speed, T actual_speed, const ControlTiming<T> &timing)
+  {
+    // 3: Calculate error
+    T error = desired_speed - actual_speed;
+
+    // 4: Calculate Derivative Error
+    low_passed_pv = alpha * (actual_speed_last - actual_speed) * timing.rate_hz + one_minus_alpha * low_passed_pv;
+    T d_error = low_passed_pv;
+
+    // 5: Calculate Integral Error
+    // 5a: Calculate Error
+    i_error += error * timing.d_t_sec;
+
+    // 5b: Perform clamping
+    if (has_i_clamp)
+    {
+      i_error = i_error > i_clamp ? i_clamp : (i_error < -i_clamp ? -i_clamp : i_error);
+    }
+
+    // 6: Sum P, I and D terms
+    T feedback = k_p * error + k_d * d_error + k_i * i_error;
+
+    // 7: Calculate feedforward
+    T feedforward = k_kv * desired_speed;
+
+    int signal = roundToInt(feedforward + feedback);
+
+    actual_speed_last = actual_speed;
+    return applyDeadband(signal, desired_speed, actual_speed, deadband);
+  }
+
+private:
+  /* the integral is clamped in output units, so the clamp depends on k_i */
+  void updateIntegralClamp()
+  {
+    has_i_clamp = k_i_float != 0.0f;
+    i_clamp = has_i_clamp ? T(integral_clamp / k_i_float) : T();
+  }
+
+  T alpha = T(PID_DERIVATIVE_ALPHA);
+  T one_minus_alpha = T(1.0f - PID_DERIVATIVE_ALPHA);
+  T deadband = T(PID_DEADBAND);
+  float integral_clamp = PID_INTEGRAL_CLAMP;
+  float k_i_float = 0.0f;
+
+  T k_p{};
+  T k_i{};
+  T k_d{};
+  T k_kv{};
+  T i_clamp{};
+  bool has_i_clamp = false;
+
+  T i_error{};
+  T low_passed_pv{};
+  T actual_speed_last{};
+};
+
+#endif  // PID_KERNEL_H
@@ -0,0 +1,114 @@
+#include "request_framer/request_framer.h"
+
+#include <cstdio>
+
+namespace
+{
+/* a uint32 varint is at most 5 bytes long */
+constexpr uint32_t MAX_VARINT_LENGTH = 5;
+}  // namespace
+
+uint8_t *RequestFramer::recvBuffer(uint32_t &space)
+{
+  uint32_t offset = head & (RING_SIZE - 1);
+  uint32_t free = RING_SIZE - buffered();
+  uint32_t until_wrap = RING_SIZE - offset;
+  space = free < until_wrap ? free : until_wrap;
+  return &ring[offset];
+}
+
+void RequestFramer::commit(uint32_t length)
+{
+  head += length;
+}
+
+void RequestFramer::reset()
+{
+  head = 0;
+  tail = 0;
+}
+
+/*
+Decode the oldest complete frame, if there is one.
+@param[out] request decoded message, only valid when FRAME is returned
+*/
+RequestFramer::Status RequestFramer::nextFrame(RequestMessage &request)
+{
+  while (true)
+  {
+    uint32_t length;
+    uint32_t prefix_length;
+    Status status = peekLength(length, prefix_length);
+    if (status != Status::FRAME)
+    {
+      return status;
+    }
+    if (length > RequestMessage_size)
+    {
+      printf("Request frame of %lu bytes is too long\r\n", static_cast<unsigned long>(length));
+      return Status::ERROR;
+    }
+    if (buffered() < prefix_length + length)
+    {
+      return Status::NEED_MORE;
+    }
+
+    read_pos = tail + prefix_length;
+    pb_istream_t istream = { &RequestFramer::readRing, this, length };
+    request = RequestMessage_init_zero;
+    bool istatus = pb_decode(&istream, RequestMessage_fields, &request);
+    tail += prefix_length + length;
+
+    if (istatus)
+    {
+      return Status::FRAME;
+    }
+    // the length prefix was valid, so the next frame still starts in the right place
+    printf("Decoding failed: %s\n", PB_GET_ERROR(&istream));
+  }
+}
+
+uint32_t RequestFramer::buffered() const
+{
+  return head - tail;
+}
+
+uint8_t RequestFramer::at(uint32_t index) const
+{
+  return ring[index & (RING_SIZE - 1)];
+}
+
+RequestFramer::Status RequestFramer::peekLength(uint32_t &length, uint32_t &prefix_length) const
+{
+  length = 0;
+  for (prefix_length = 0; prefix_length < MAX_VARINT_LENGTH; ++prefix_length)
+  {
+    if (prefix_length >= buffered())
+    {
+      return Status::NEED_MORE;
+    }
+    uint8_t byte = at(tail + prefix_length);
+    length |= static_cast<uint32_t>(byte & 0x7F) << (7 * prefix_length);
+    if ((byte & 0x80) == 0)
+    {
+      ++prefix_length;
+      return Status::FRAME;
+    }
+  }
+  return Status::ERROR;
+}
+
+/* nanopb input callback reading the frame out of the ring */
+bool RequestFramer::readRing(pb_istream_t *stream, uint8_t *buf, size_t count)
+{
+  auto *framer = static_cast<RequestFramer *>(stream->state);
+  for (size_t i = 0; i < count; ++i)
+  {
+    uint8_t byte = framer->at(framer->read_pos++);
+    if (buf != nullptr)
+    {
+      buf[i] = byte;
+    }
+  }
+  return true;
+}
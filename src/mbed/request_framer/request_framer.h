@@ -0,0 +1,63 @@
+#ifndef REQUEST_FRAMER_H
+#define REQUEST_FRAMER_H
+
+#include <cstdint>
+
+#include <pb_decode.h>
+#include "igvc.pb.h"
+
+/* The smallest power of two that is at least value */
+constexpr uint32_t roundUpToPowerOfTwo(uint32_t value)
+{
+  uint32_t power = 1;
+  while (power < value)
+  {
+    power <<= 1;
+  }
+  return power;
+}
+
+/**
+ * Splits a TCP byte stream into RequestMessages.
+ *
+ * Every message on the wire is prefixed by its length as a varint, i.e. what pb_encode_delimited()
+ * writes. recv() writes straight into a persistent ring buffer, so a read may end in the middle of a
+ * frame or contain several frames; nextFrame() hands out every complete frame and keeps the rest for
+ * the next read.
+ */
+class RequestFramer
+{
+public:
+  /* The largest request with its length prefix, a uint32 varint of at most 5 bytes. A frame must fit in the
+   * ring whole, or it can never be decoded */
+  static constexpr uint32_t RING_SIZE = roundUpToPowerOfTwo(RequestMessage_size + 5);
+
+  enum class Status
+  {
+    NEED_MORE,  // no complete frame buffered
+    FRAME,      // a request was decoded
+    ERROR       // the stream is corrupt and cannot be resynchronized
+  };
+
+  /* Contiguous free space to recv() into. Call commit() with the number of bytes received */
+  uint8_t *recvBuffer(uint32_t &space);
+  void commit(uint32_t length);
+  Status nextFrame(RequestMessage &request);
+  void reset();
+
+private:
+  static_assert((RING_SIZE & (RING_SIZE - 1)) == 0, "RING_SIZE must be a power of two");
+  static_assert(RING_SIZE >= RequestMessage_size + 5, "the largest request must fit in the ring");
+
+  uint8_t ring[RING_SIZE];
+  uint32_t head = 0;
+  uint32_t tail = 0;
+  uint32_t read_pos = 0;  // tail while a frame is being decoded
+
+  uint32_t buffered() const;
+  uint8_t at(uint32_t index) const;
+  Status peekLength(uint32_t &length, uint32_t &prefix_length) const;
+  static bool readRing(pb_istream_t *stream, uint8_t *buf, size_t count);
+};
+
+#endif  // REQUEST_FRAMER_H
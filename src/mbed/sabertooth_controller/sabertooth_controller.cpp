@@ -1,23 +1,94 @@
 #include "sabertooth_controller.h"
-#include "mbed.h"
 
 SaberToothController::SaberToothController()
-        : sabertooth(p13, NC, 9600), left_output(0), right_output(0)
+        : SaberToothController(p13, DEFAULT_BAUD, DEFAULT_KEEPALIVE_MS)
 {
-  stopMotors();
 }
 
 SaberToothController::SaberToothController(PinName tx_pin)
-        : sabertooth(tx_pin, NC, 9600), left_output(0), right_output(0)
+        : SaberToothController(tx_pin, DEFAULT_BAUD, DEFAULT_KEEPALIVE_MS)
+{
+}
+
+SaberToothController::SaberToothController(PinName tx_pin, int baud, int keepalive_ms)
+        : tx_pin(tx_pin),
+          sabertooth(tx_pin, NC, baud),
+          keepalive_ms(keepalive_ms),
+          tx_active(false),
+          left_output(0),
+          right_output(0),
+          left_sent(false),
+          right_sent(false),
+          stopped(false),
+          stop_pending(false),
+          stop_requested_us(0),
+          stop_latency_us(0),
+          max_stop_latency_us(0),
+          emergency_stops(0)
 {
+  keepalive_timer.start();
   stopMotors();
 }
 
 void SaberToothController::stopMotors()
 {
-  sabertooth.putc(0);
+  // an emergency stop already holds the motors, and repeats the stop itself
+  if (stopped)
+  {
+    return;
+  }
+  {
+    // drop whatever is still queued, the stop has to go out first
+    hal::CriticalSectionLock lock;
+    tx_queue.clear();
+  }
+  send(0);
+  left_output = 0;
+  right_output = 0;
+  left_sent = false;
+  right_sent = false;
+}
+
+/*
+Safe to call from an interrupt handler. The critical section keeps the thread side of the queue out while
+it is replaced by the stop byte.
+*/
+void SaberToothController::emergencyStop(uint64_t requested_us)
+{
+  hal::CriticalSectionLock lock;
+  stopped = true;
+  stop_pending = true;
+  stop_requested_us = requested_us;
+  ++emergency_stops;
   left_output = 0;
   right_output = 0;
+  left_sent = false;
+  right_sent = false;
+
+  tx_queue.clear();
+  hal::flushSerialTx(tx_pin);
+  tx_queue.push(0);
+  startTx();
+}
+
+void SaberToothController::releaseStop()
+{
+  stopped = false;
+}
+
+uint32_t SaberToothController::getStopLatencyUs()
+{
+  return stop_latency_us;
+}
+
+uint32_t SaberToothController::getMaxStopLatencyUs()
+{
+  return max_stop_latency_us;
+}
+
+uint32_t SaberToothController::getEmergencyStops()
+{
+  return emergency_stops;
 }
 
 uint32_t SaberToothController::getLeftOutput()
@@ -35,8 +106,12 @@ void SaberToothController::setLeftMotor(int speed)
   // Motor 2: Left (128-255 for valid motor values)
   // motor outputs are inverted due to how the motors are mounted
   speed = min(63, max(-64, speed)) + 64;
-  left_output = -static_cast<unsigned char>(speed + 128);
-  sabertooth.putc(left_output);
+  unsigned char output = -static_cast<unsigned char>(speed + 128);
+  if (!left_sent || output != left_output)
+  {
+    left_output = output;
+    left_sent = send(left_output);
+  }
 }
 
 void SaberToothController::setRightMotor(int speed)
@@ -44,12 +119,98 @@ void SaberToothController::setRightMotor(int speed)
   // Motor 1: Right (1-127 for valid motor values)
   // motor outputs are inverted due to how the motors are mounted
   speed = min(63, max(-63, speed)) + 64;
-  right_output = -static_cast<unsigned char>(speed);
-  sabertooth.putc(right_output);
+  unsigned char output = -static_cast<unsigned char>(speed);
+  if (!right_sent || output != right_output)
+  {
+    right_output = output;
+    right_sent = send(right_output);
+  }
 }
 
 void SaberToothController::setSpeeds(int right_speed, int left_speed)
 {
+  // resend both motors' values once per keep-alive interval even if they did not change
+  bool keepalive_due = keepalive_timer.read_ms() >= keepalive_ms;
+  if (keepalive_due)
+  {
+    keepalive_timer.reset();
+    left_sent = false;
+    right_sent = false;
+  }
+  // hold an emergency stop, repeating it like any other command
+  if (stopped)
+  {
+    left_output = 0;
+    right_output = 0;
+    if (keepalive_due)
+    {
+      send(0);
+    }
+    return;
+  }
   setLeftMotor(left_speed);
   setRightMotor(right_speed);
 }
+
+/*
+Queue a byte and make sure the TX interrupt is draining the queue.
+@return false if the byte was dropped, because the queue is full or an emergency stop holds the motors; the
+setters then send it again on the next call
+*/
+bool SaberToothController::send(unsigned char byte)
+{
+  // emergencyStop() may replace the queue from an interrupt, and nothing but stops may follow it
+  hal::CriticalSectionLock lock;
+  if (stopped && byte != 0)
+  {
+    return false;
+  }
+  bool queued = tx_queue.push(byte);
+  startTx();
+  return queued;
+}
+
+/* Must be called inside a critical section */
+void SaberToothController::startTx()
+{
+  if (!tx_active)
+  {
+    tx_active = true;
+    sabertooth.attach(hal::callback(this, &SaberToothController::onTxReady), hal::SerialBase::TxIrq);
+    // prime the transmitter, the interrupt only fires once the holding register empties
+    onTxReady();
+  }
+  else if (stop_pending && sabertooth.writeable())
+  {
+    // the transmitter was just flushed, don't wait for its interrupt
+    onTxReady();
+  }
+}
+
+/*
+UART TX interrupt: move queued bytes into the transmitter. Disables itself once the queue is empty.
+*/
+void SaberToothController::onTxReady()
+{
+  unsigned char byte;
+  while (sabertooth.writeable())
+  {
+    if (!tx_queue.pop(byte))
+    {
+      sabertooth.attach(hal::Callback<void()>(), hal::SerialBase::TxIrq);
+      tx_active = false;
+      return;
+    }
+    sabertooth.putc(byte);
+    if (stop_pending && byte == 0)
+    {
+      auto latency_us = static_cast<uint32_t>(hal::readMicros() - stop_requested_us);
+      stop_pending = false;
+      stop_latency_us = latency_us;
+      if (latency_us > max_stop_latency_us)
+      {
+        max_stop_latency_us = latency_us;
+      }
+    }
+  }
+}
@@ -1,16 +1,30 @@
 #ifndef ST_CONTROLLER
 #define ST_CONTROLLER
 
-#include "mbed.h"
+#include "hal/hal.h"
+#include "spsc_ring/spsc_ring.h"
 
 // Sabertooth 2x60
 // Motor 1: Right
 // Motor 2: Left
+//
+// Commands are queued and written out by the UART TX interrupt, so none of the methods block on the
+// serial line. A motor's byte is only sent when it changes, or again after keepalive_ms.
+//
+// emergencyStop() may be called from an interrupt handler. It puts the stop byte into the UART ahead of
+// anything queued and holds both motors stopped until releaseStop(); the byte being shifted out when it is
+// called is the only one that still goes out before it, so the stop reaches the Sabertooth within two byte
+// times (~2.1 ms at 9600 baud, ~0.5 ms at 38400).
 class SaberToothController
 {
   public:
+    static constexpr int DEFAULT_BAUD = 9600;
+    static constexpr int DEFAULT_KEEPALIVE_MS = 100;
+
     SaberToothController();
     explicit SaberToothController(PinName tx_pin);
+    // baud must match the Sabertooth's DIP switches (2400, 9600, 19200 or 38400 in simplified serial)
+    SaberToothController(PinName tx_pin, int baud, int keepalive_ms);
     void stopMotors();
     uint32_t getLeftOutput();
     uint32_t getRightOutput();
@@ -18,10 +32,36 @@ class SaberToothController
     void setRightMotor(int speed);
     void setSpeeds(int right_speed, int left_speed);
 
+    // requested_us is the hal::readMicros() time the stop latency is measured from, e.g. the e-stop edge
+    void emergencyStop(uint64_t requested_us);
+    void releaseStop();
+    // Time from requested_us until the stop byte was written to the UART, of the last and the slowest stop
+    uint32_t getStopLatencyUs();
+    uint32_t getMaxStopLatencyUs();
+    uint32_t getEmergencyStops();
+
   private:
-    RawSerial sabertooth;
+    PinName tx_pin;
+    hal::RawSerial sabertooth;
+    hal::Timer keepalive_timer;
+    int keepalive_ms;
+    SpscRing<unsigned char, 16> tx_queue;
+    volatile bool tx_active;
     unsigned char left_output;
     unsigned char right_output;
+    bool left_sent;
+    bool right_sent;
+
+    volatile bool stopped;
+    volatile bool stop_pending;
+    uint64_t stop_requested_us;
+    volatile uint32_t stop_latency_us;
+    volatile uint32_t max_stop_latency_us;
+    volatile uint32_t emergency_stops;
+
+    bool send(unsigned char byte);
+    void startTx();
+    void onTxReady();
 };
 
 #endif
@@ -0,0 +1,310 @@
+#ifndef SETPOINT_QUEUE_H
+#define SETPOINT_QUEUE_H
+
+#include <cstdint>
+#include <type_traits>
+
+#include "pid_kernel/pid_kernel.h"
+#include "utils.h"
+
+/**
+ * Limits how fast a setpoint may change: its rate of change (acceleration) to accel_limit and the rate of
+ * change of that (jerk) to jerk_limit. The acceleration is brought back to zero early enough to arrive at the
+ * target without overshooting it. A limit of zero turns that limit off.
+ */
+template <typename T>
+class JerkLimiter
+{
+public:
+  void setLimits(T accel, T jerk)
+  {
+    accel_limit = accel;
+    jerk_limit = jerk;
+  }
+
+  /* Continue from value, at rest */
+  void reset(T value)
+  {
+    output = value;
+    accel = T();
+  }
+
+  T value() const
+  {
+    return output;
+  }
+
+  /* Moves the output one control period towards target. @return the new output */
+  T update(T target, const ControlTiming<T> &timing)
+  {
+    const T zero{};
+    T error = target - output;
+    if (accel_limit == zero)
+    {
+      output = target;
+      accel = zero;
+      return output;
+    }
+
+    T wanted = error > zero ? accel_limit : -accel_limit;
+    if (jerk_limit != zero)
+    {
+      // braking from accel at jerk_limit takes accel^2 / (2 jerk) of setpoint change
+      bool same_way = (accel > zero) == (error > zero);
+      if (same_way && accel * accel >= T(2) * jerk_limit * absolute(error))
+      {
+        wanted = zero;
+      }
+      T step = jerk_limit * timing.d_t_sec;
+      T change = wanted - accel;
+      accel += change > step ? step : (change < -step ? -step : change);
+    }
+    else
+    {
+      accel = wanted;
+    }
+
+    T next = output + accel * timing.d_t_sec;
+    if ((error > zero && next >= target) || (error < zero && next <= target) || error == zero)
+    {
+      // arrived; it can only be left with a new target, starting from rest
+      next = target;
+      accel = zero;
+    }
+    output = next;
+    return output;
+  }
+
+private:
+  T accel_limit{};
+  T jerk_limit{};
+  T output{};
+  T accel{};
+};
+
+/**
+ * Timestamped wheel speed setpoints, queued ahead of time and followed at the control rate.
+ *
+ * The host sends a short trajectory (see TrajectoryPoint) with every request instead of a single setpoint.
+ * Between two points the setpoints are interpolated linearly, and the result goes through a JerkLimiter
+ * per wheel, so the wheels follow a smooth profile however irregularly the requests arrive. A new trajectory
+ * replaces the queued points from its first point on. When the last point has passed the queue has run dry
+ * and holds the last setpoints. Points count as a command only when their request arrives, not while they are
+ * followed, so the control loop's CommandTimeout ramps the setpoints down to zero when the requests stop,
+ * however far ahead the queue reaches.
+ *
+ * Points are timed in the host's clock. Like CommandFilter, the queue takes the smallest
+ * (arrival - host_time_us) offset seen as zero delay, so a request that arrives late still lands its points
+ * at the times the host meant. The minimum is relaxed slowly to follow clock drift.
+ */
+template <typename T>
+class SetpointQueue
+{
+public:
+  static constexpr uint32_t CAPACITY = TRAJECTORY_QUEUE_SIZE;
+
+  struct Point
+  {
+    uint64_t time_us;  // mbed clock, see toLocalTime()
+    T speed_l;
+    T speed_r;
+  };
+
+  void setLimits(float accel, float jerk)
+  {
+    limiter_l.setLimits(T(accel), T(jerk));
+    limiter_r.setLimits(T(accel), T(jerk));
+  }
+
+  /*
+  Maps a time of the host's clock to the mbed's.
+  @param[in] host_time_us host_time_us of the request
+  @param[in] arrival_us hal::readMicros() when the request arrived
+  */
+  uint64_t toLocalTime(uint64_t host_time_us, uint64_t arrival_us)
+  {
+    uint64_t offset_us = arrival_us - host_time_us;
+    if (!has_offset || static_cast<int64_t>(offset_us - min_offset_us) < 0)
+    {
+      min_offset_us = offset_us;
+      has_offset = true;
+    }
+    else
+    {
+      // 1 us per 8 ms, like CommandFilter; much faster than the crystals drift apart
+      uint64_t relax_us = (arrival_us - last_arrival_us) >> RELAX_SHIFT;
+      min_offset_us += relax_us < offset_us - min_offset_us ? relax_us : offset_us - min_offset_us;
+    }
+    last_arrival_us = arrival_us;
+    return host_time_us + min_offset_us;
+  }
+
+  /*
+  Queues points, replacing the queued ones at or after the first of them. Points must be in time order; the
+  ones that are not, that lie in the past or beyond TRAJECTORY_HORIZON_MS, or that don't fit are dropped.
+  @param[in] current_l, current_r the setpoints in use now, where the trajectory starts from unless the queue
+  still has points ahead
+  @return the number of points queued
+  */
+  uint32_t push(const Point *points, uint32_t count, uint64_t now_us, T current_l, T current_r)
+  {
+    if (!is_active)
+    {
+      limiter_l.reset(current_l);
+      limiter_r.reset(current_r);
+    }
+    if (!is_active || is_dry)
+    {
+      // the first segment starts here, not at a point long past
+      from = { now_us, current_l, current_r };
+      is_active = true;
+    }
+    compact();
+
+    uint32_t queued = 0;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      const Point &point = points[i];
+      int64_t ahead_us = static_cast<int64_t>(point.time_us - now_us);
+      if (ahead_us <= 0)
+      {
+        continue;
+      }
+      if (ahead_us > HORIZON_US)
+      {
+        break;
+      }
+      if (queued == 0)
+      {
+        // splice: drop what the new trajectory replaces
+        while (size > 0 && static_cast<int64_t>(queue[size - 1].time_us - point.time_us) >= 0)
+        {
+          --size;
+        }
+      }
+      else if (static_cast<int64_t>(point.time_us - queue[size - 1].time_us) <= 0)
+      {
+        continue;
+      }
+      if (size == CAPACITY)
+      {
+        break;
+      }
+      queue[size++] = point;
+      ++queued;
+    }
+    if (queued > 0)
+    {
+      is_dry = false;
+    }
+    return queued;
+  }
+
+  /* Leaves trajectory mode, e.g. for a plain speed_l / speed_r setpoint */
+  void clear()
+  {
+    next = 0;
+    size = 0;
+    is_active = false;
+    is_dry = false;
+  }
+
+  /* Whether the setpoints come from the queue, including while it holds after running dry */
+  bool active() const
+  {
+    return is_active;
+  }
+
+  /*
+  Call once per control period while active().
+  @param[out] desired_l, desired_r the setpoints for this period
+  @return false once the last point has passed, i.e. the queue has run dry and holds the last point
+  */
+  bool sample(uint64_t now_us, const ControlTiming<T> &timing, T &desired_l, T &desired_r)
+  {
+    while (next < size && static_cast<int64_t>(queue[next].time_us - now_us) <= 0)
+    {
+      from = queue[next++];
+    }
+
+    T target_l = from.speed_l;
+    T target_r = from.speed_r;
+    if (next < size)
+    {
+      const Point &to = queue[next];
+      int64_t elapsed_us = static_cast<int64_t>(now_us - from.time_us);
+      int64_t length_us = static_cast<int64_t>(to.time_us - from.time_us);
+      T fraction = ratio(elapsed_us < 0 ? 0 : elapsed_us, length_us);
+      target_l = from.speed_l + (to.speed_l - from.speed_l) * fraction;
+      target_r = from.speed_r + (to.speed_r - from.speed_r) * fraction;
+    }
+    else if (!is_dry)
+    {
+      is_dry = true;
+      ++underrun_count;
+    }
+
+    desired_l = limiter_l.update(target_l, timing);
+    desired_r = limiter_r.update(target_r, timing);
+    return !is_dry;
+  }
+
+  /* Points still ahead */
+  uint32_t queued() const
+  {
+    return size - next;
+  }
+
+  /* How often the queue ran dry */
+  uint32_t underruns() const
+  {
+    return underrun_count;
+  }
+
+private:
+  static constexpr int RELAX_SHIFT = 13;
+  static constexpr int64_t HORIZON_US = TRAJECTORY_HORIZON_MS * 1000LL;
+
+  Point queue[CAPACITY]{};
+  uint32_t next = 0;  // the first point that hasn't been reached
+  uint32_t size = 0;
+  Point from{};       // the last point reached, where the current segment starts
+  bool is_active = false;
+  bool is_dry = false;
+  uint32_t underrun_count = 0;
+  JerkLimiter<T> limiter_l;
+  JerkLimiter<T> limiter_r;
+
+  bool has_offset = false;
+  uint64_t min_offset_us = 0;
+  uint64_t last_arrival_us = 0;
+
+  /* Moves the points ahead to the front */
+  void compact()
+  {
+    for (uint32_t i = next; i < size; ++i)
+    {
+      queue[i - next] = queue[i];
+    }
+    size -= next;
+    next = 0;
+  }
+
+  static T ratio(int64_t numerator, int64_t denominator)
+  {
+    if (numerator >= denominator)
+    {
+      return T(1);
+    }
+    if constexpr (std::is_floating_point<T>::value)
+    {
+      return static_cast<T>(numerator) / static_cast<T>(denominator);
+    }
+    else
+    {
+      return T::fromRatio(numerator, denominator);
+    }
+  }
+};
+
+#endif  // SETPOINT_QUEUE_H
@@ -0,0 +1,278 @@
+#include "sim/control_scenario.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <limits>
+
+#include "encoder_pair/encoder_pair.h"
+#include "sabertooth_controller/sabertooth_controller.h"
+#include "velocity_estimator/velocity_estimator.h"
+#include "wheel_controller/wheel_controller.h"
+
+namespace
+{
+constexpr double PI = 3.14159265358979323846;
+/* Plant integration steps per control period, i.e. 50 us steps */
+constexpr int PLANT_STEPS_PER_PERIOD = 100;
+constexpr int32_t PLANT_STEP_US = CONTROL_PERIOD_US / PLANT_STEPS_PER_PERIOD;
+/* Only the scenario's SaberToothController writes to it, there is no SimWorld in the process */
+constexpr PinName SABERTOOTH_TX = p13;
+/* 8N1, ten bits per byte */
+constexpr uint64_t SABERTOOTH_BYTE_US = 10 * 1000000 / SABERTOOTH_BAUD;
+
+/* A byte on its way to the Sabertooth, and when it has been shifted out */
+struct LineByte
+{
+  uint64_t done_us;
+  uint8_t byte;
+};
+
+/* Metrics of one wheel, accumulated at every plant step */
+class WheelMetrics
+{
+public:
+  WheelMetrics(const SetpointProfile &setpoint, float scale, double duration_sec)
+    : setpoint(setpoint), scale(scale), duration_sec(duration_sec)
+  {
+    initial = setpoint.initial * scale;
+    target = setpoint.target * scale;
+  }
+
+  void add(double time_sec, double speed)
+  {
+    if (time_sec < setpoint.start_sec)
+    {
+      return;
+    }
+    double error = setpoint.at(time_sec) * scale - speed;
+    squared_error_sum += error * error;
+    ++samples;
+    if (time_sec >= duration_sec - STEADY_STATE_WINDOW_SEC)
+    {
+      steady_error_sum += std::abs(error);
+      ++steady_samples;
+    }
+
+    // how far the speed has come, in the direction of the step
+    double step = target - initial;
+    if (std::abs(step) < 1e-6)
+    {
+      return;
+    }
+    double progress = (speed - initial) / step;
+    if (std::isnan(t10) && progress >= 0.1)
+    {
+      t10 = time_sec;
+    }
+    if (std::isnan(t90) && progress >= 0.9)
+    {
+      t90 = time_sec;
+    }
+    peak_progress = progress > peak_progress ? progress : peak_progress;
+  }
+
+  ScenarioMetrics result() const
+  {
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    ScenarioMetrics metrics{ nan, nan, nan, nan, 0.0, 0.0 };
+    bool is_step = setpoint.shape == SetpointProfile::Shape::STEP && std::abs(target - initial) >= 1e-6;
+    if (is_step)
+    {
+      metrics.rise_sec = std::isnan(t90) ? std::numeric_limits<double>::infinity() : t90 - t10;
+      metrics.overshoot = peak_progress > 1.0 ? peak_progress - 1.0 : 0.0;
+    }
+    if (setpoint.shape != SetpointProfile::Shape::SINE && steady_samples > 0)
+    {
+      metrics.steady_state_error = steady_error_sum / steady_samples;
+    }
+    if (samples > 0)
+    {
+      metrics.tracking_rms = std::sqrt(squared_error_sum / samples);
+    }
+    return metrics;
+  }
+
+private:
+  const SetpointProfile &setpoint;
+  float scale;
+  double duration_sec;
+  double initial;
+  double target;
+  double t10 = std::numeric_limits<double>::quiet_NaN();
+  double t90 = std::numeric_limits<double>::quiet_NaN();
+  double peak_progress = 0.0;
+  double squared_error_sum = 0.0;
+  long samples = 0;
+  double steady_error_sum = 0.0;
+  long steady_samples = 0;
+};
+
+/* The larger of two metrics, where NaN means not applicable */
+double worse(double a, double b)
+{
+  if (std::isnan(a))
+  {
+    return b;
+  }
+  return std::isnan(b) || a > b ? a : b;
+}
+
+/* Puts what SaberToothController wrote on the serial line, behind the bytes still being shifted out */
+void queueSabertoothBytes(std::deque<LineByte> &line, uint64_t now_us)
+{
+  uint64_t free_us = line.empty() || line.back().done_us < now_us ? now_us : line.back().done_us;
+  for (uint8_t byte : hal::sim::takeSerialBytes(SABERTOOTH_TX))
+  {
+    free_us += SABERTOOTH_BYTE_US;
+    line.push_back({ free_us, byte });
+  }
+}
+
+template <typename T>
+ScenarioMetrics run(const Scenario &scenario, std::vector<TraceSample> *trace)
+{
+  PlantModel plant(scenario.plant);
+  SaberToothController sabertooth(SABERTOOTH_TX, SABERTOOTH_BAUD, SABERTOOTH_KEEPALIVE_MS);
+  std::deque<LineByte> line;
+  queueSabertoothBytes(line, 0);
+
+  WheelController<T> controllers[2];
+  VelocityEstimator<T> estimators[2];
+  for (WheelController<T> &controller : controllers)
+  {
+    controller.setCoeffs(scenario.gains);
+    controller.setTuning(scenario.tuning);
+    controller.select(scenario.controller);
+  }
+  const float scales[2] = { 1.0f, scenario.setpoint.right_scale };
+  WheelMetrics wheel_metrics[2] = { { scenario.setpoint, scales[0], scenario.duration_sec },
+                                    { scenario.setpoint, scales[1], scenario.duration_sec } };
+
+  std::vector<EncoderEdge> edges[2];
+  int32_t ticks[2] = { 0, 0 };
+  uint64_t step_start_us = 0;
+  const PlantModel::TickCallback on_tick = [&](int wheel, int direction, double fraction) {
+    edges[wheel].push_back({ step_start_us + static_cast<uint64_t>(std::lround(fraction * PLANT_STEP_US)), direction });
+    ticks[wheel] += direction;
+  };
+
+  const ControlTiming<T> timing = ControlTiming<T>::fromPeriod(CONTROL_PERIOD_US);
+  const auto periods = static_cast<long>(scenario.duration_sec * 1e6 / CONTROL_PERIOD_US);
+  double min_battery_v = plant.batteryVolts();
+  double max_current_a = 0.0;
+  for (long period = 0; period < periods; ++period)
+  {
+    for (int step = 0; step < PLANT_STEPS_PER_PERIOD; ++step)
+    {
+      while (!line.empty() && line.front().done_us <= step_start_us)
+      {
+        plant.receiveSabertooth(line.front().byte);
+        line.pop_front();
+      }
+      double time_sec = static_cast<double>(step_start_us) * 1e-6;
+      double load = time_sec >= scenario.load_start_sec ? scenario.load_torque : 0.0;
+      plant.setLoadTorque(PlantModel::LEFT, load);
+      plant.setLoadTorque(PlantModel::RIGHT, load);
+
+      plant.step(PLANT_STEP_US * 1e-6, on_tick);
+      step_start_us += PLANT_STEP_US;
+
+      time_sec = static_cast<double>(step_start_us) * 1e-6;
+      for (int wheel = PlantModel::LEFT; wheel <= PlantModel::RIGHT; ++wheel)
+      {
+        wheel_metrics[wheel].add(time_sec, plant.speed(wheel));
+        max_current_a = std::max(max_current_a, std::abs(plant.current(wheel)));
+      }
+      min_battery_v = std::min(min_battery_v, plant.batteryVolts());
+    }
+
+    // what pid() does with the snapshot at the end of the period, minus the setpoint sources
+    const uint64_t now_us = step_start_us;
+    const double time_sec = static_cast<double>(now_us) * 1e-6;
+    T desired[2];
+    T actual[2];
+    int signals[2];
+    for (int wheel = PlantModel::LEFT; wheel <= PlantModel::RIGHT; ++wheel)
+    {
+      for (const EncoderEdge &edge : edges[wheel])
+      {
+        estimators[wheel].addEdge(edge);
+      }
+      edges[wheel].clear();
+      actual[wheel] = estimators[wheel].estimate(ticks[wheel], now_us, CONTROL_PERIOD_US);
+      ticks[wheel] = 0;
+      desired[wheel] = T(scenario.setpoint.at(time_sec) * scales[wheel]);
+      signals[wheel] = controllers[wheel].update(desired[wheel], actual[wheel], timing);
+    }
+    sabertooth.setSpeeds(signals[PlantModel::RIGHT], signals[PlantModel::LEFT]);
+    queueSabertoothBytes(line, now_us);
+
+    if (trace != nullptr)
+    {
+      trace->push_back({ time_sec, toFloat(desired[0]), toFloat(desired[1]), toFloat(actual[0]), toFloat(actual[1]),
+                         plant.speed(PlantModel::LEFT), plant.speed(PlantModel::RIGHT),
+                         plant.command(PlantModel::LEFT), plant.command(PlantModel::RIGHT), plant.batteryVolts() });
+    }
+  }
+
+  ScenarioMetrics left = wheel_metrics[0].result();
+  ScenarioMetrics right = wheel_metrics[1].result();
+  return { worse(left.rise_sec, right.rise_sec),
+           worse(left.overshoot, right.overshoot),
+           worse(left.steady_state_error, right.steady_state_error),
+           worse(left.tracking_rms, right.tracking_rms),
+           min_battery_v,
+           max_current_a };
+}
+
+/* Appends "name value > limit" to failures if the metric applies and is beyond its limit */
+bool checkLimit(const char *name, double value, double limit, std::string &failures)
+{
+  if (std::isnan(value) || value <= limit)
+  {
+    return true;
+  }
+  char text[64];
+  snprintf(text, sizeof(text), "%s%s %.3g > %.3g", failures.empty() ? "" : ", ", name, value, limit);
+  failures += text;
+  return false;
+}
+}  // namespace
+
+float SetpointProfile::at(double time_sec) const
+{
+  if (time_sec < start_sec)
+  {
+    return initial;
+  }
+  double since_start = time_sec - start_sec;
+  switch (shape)
+  {
+    case Shape::RAMP:
+      return since_start >= period_sec
+                 ? target
+                 : initial + static_cast<float>((target - initial) * since_start / period_sec);
+    case Shape::SINE:
+      return initial + target * static_cast<float>(std::sin(2.0 * PI * since_start / period_sec));
+    case Shape::STEP:
+    default:
+      return target;
+  }
+}
+
+ScenarioMetrics runScenario(const Scenario &scenario, bool fixed_point, std::vector<TraceSample> *trace)
+{
+  return fixed_point ? run<ControlScalar>(scenario, trace) : run<float>(scenario, trace);
+}
+
+bool checkLimits(const ScenarioMetrics &metrics, const ScenarioLimits &limits, std::string &failures)
+{
+  failures.clear();
+  bool ok = checkLimit("rise", metrics.rise_sec, limits.rise_sec, failures);
+  ok = checkLimit("overshoot", metrics.overshoot, limits.overshoot, failures) && ok;
+  ok = checkLimit("steady_state_error", metrics.steady_state_error, limits.steady_state_error, failures) && ok;
+  ok = checkLimit("tracking_rms", metrics.tracking_rms, limits.tracking_rms, failures) && ok;
+  return ok;
+}
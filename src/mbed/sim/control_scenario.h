@@ -0,0 +1,103 @@
+#ifndef CONTROL_SCENARIO_H
+#define CONTROL_SCENARIO_H
+
+#include <string>
+#include <vector>
+
+#include "igvc.pb.h"
+#include "sim/plant_model.h"
+#include "utils.h"
+
+/* Setpoint of both wheels over a scenario, in m/s. The right wheel's is scaled by right_scale, to turn */
+struct SetpointProfile
+{
+  enum class Shape
+  {
+    STEP,  // initial until start_sec, then target
+    RAMP,  // initial until start_sec, then linearly to target over period_sec, then held
+    SINE   // initial until start_sec, then initial + target * sin(2 pi t / period_sec)
+  };
+
+  Shape shape = Shape::STEP;
+  float initial = 0.0f;
+  float target = 1.0f;
+  double start_sec = 0.5;
+  double period_sec = 1.0;
+  float right_scale = 1.0f;
+
+  float at(double time_sec) const;
+};
+
+/* Worst acceptable metrics of a scenario. Limits of metrics that don't apply to its setpoint are ignored */
+struct ScenarioLimits
+{
+  double rise_sec = 1e9;
+  double overshoot = 1e9;
+  double steady_state_error = 1e9;
+  double tracking_rms = 1e9;
+};
+
+/* One closed loop run: a controller with its gains, a plant, a setpoint and what is expected of them */
+struct Scenario
+{
+  std::string name;
+  ControllerType controller = ControllerType_CONTROLLER_PID;
+  PIDCoeffs gains;
+  PidTuning tuning;
+  PlantParams plant;
+  SetpointProfile setpoint;
+  double load_torque = 0.0;  // N m on both wheels from load_start_sec on, e.g. a slope
+  double load_start_sec = 0.0;
+  double duration_sec = 3.0;
+  ScenarioLimits limits;
+};
+
+/*
+Control performance of a run, measured on the true wheel speeds of the plant, not the firmware's estimate,
+and the worse of the two wheels. Metrics that don't apply to the setpoint's shape are NaN.
+*/
+struct ScenarioMetrics
+{
+  double rise_sec;            // steps: 10% to 90% of the step, infinite if 90% is never reached
+  double overshoot;           // steps: peak beyond the target, as a fraction of the step
+  double steady_state_error;  // steps and ramps: mean |error| over the last STEADY_STATE_WINDOW_SEC, m/s
+  double tracking_rms;        // RMS error from start_sec on, m/s
+  double min_battery_v;
+  double max_current_a;
+};
+
+/* One control period of a run */
+struct TraceSample
+{
+  double time_sec;
+  float desired_l;
+  float desired_r;
+  float estimate_l;  // the firmware's speed estimate
+  float estimate_r;
+  double speed_l;  // the plant's true speed
+  double speed_r;
+  int command_l;  // Sabertooth command as decoded by the plant
+  int command_r;
+  double battery_v;
+};
+
+constexpr double STEADY_STATE_WINDOW_SEC = 0.5;
+
+/*
+Runs the firmware's control chain of both wheels against a PlantModel in simulated time, as fast as the host
+allows. Each control period, the encoder edges of the period go through VelocityEstimator, WheelController
+turns the estimate into commands and SaberToothController into bytes, which reach the plant after their
+time on the serial line.
+@param[in] scenario
+@param[in] fixed_point run the control law in ControlScalar like the firmware, or else in float
+@param[out] trace if not null, receives every control period
+*/
+ScenarioMetrics runScenario(const Scenario &scenario, bool fixed_point, std::vector<TraceSample> *trace = nullptr);
+
+/*
+@param[out] failures the metrics beyond their limit, e.g. "overshoot 0.31 > 0.25", separated by commas
+@return whether every applicable metric is within its limit
+*/
+bool checkLimits(const ScenarioMetrics &metrics, const ScenarioLimits &limits, std::string &failures);
+
+#endif  // CONTROL_SCENARIO_H
@@ -0,0 +1,139 @@
+#include "sim/plant_model.h"
+
+#include <cmath>
+
+#include "utils.h"
+
+namespace
+{
+constexpr double PI = 3.14159265358979323846;
+constexpr double WHEEL_RADIUS = WHEEL_CIRCUM / (2.0 * PI);
+constexpr double TICKS_PER_RADIAN = TICKS_PER_REV * GEAR_RATIO / (2.0 * PI);
+/* Largest Sabertooth command magnitude, i.e. full battery voltage */
+constexpr double FULL_COMMAND = 64.0;
+}  // namespace
+
+PlantModel::PlantModel(const PlantParams &params) : params(params), battery_v(params.battery_open_circuit_v)
+{
+}
+
+/*
+Decode Sabertooth simplified serial as written by SaberToothController: 0 stops both motors, 1-128 drive the
+left motor and 129-255 the right one, each centred on its stop value. The controller inverts both outputs
+because of how the motors are mounted, so the inversion is undone here.
+*/
+void PlantModel::receiveSabertooth(uint8_t byte)
+{
+  if (byte == 0)
+  {
+    wheels[LEFT].command = 0;
+    wheels[RIGHT].command = 0;
+  }
+  else if (byte <= 128)
+  {
+    wheels[LEFT].command = 64 - byte;
+  }
+  else
+  {
+    wheels[RIGHT].command = 192 - byte;
+  }
+}
+
+void PlantModel::setLoadTorque(int wheel, double torque)
+{
+  wheels[wheel].load = torque;
+}
+
+void PlantModel::step(double d_t_sec, const TickCallback &on_tick)
+{
+  /* The currents depend on the battery voltage and the battery voltage on the currents. With armature voltage
+   * d * V and back EMF e, each motor draws i = (d * V - e) / R, of which the battery supplies d * i, so
+   * V = V_oc - R_b * sum(d * i) can be solved for V directly */
+  double duty[2];
+  double emf[2];
+  double sum_duty_squared = 0.0;
+  double sum_duty_emf = 0.0;
+  for (int i = LEFT; i <= RIGHT; ++i)
+  {
+    duty[i] = dutyCycle(wheels[i].command);
+    emf[i] = params.motor_constant * GEAR_RATIO * wheels[i].omega;
+    sum_duty_squared += duty[i] * duty[i];
+    sum_duty_emf += duty[i] * emf[i];
+  }
+  const double conductance_ratio = params.battery_resistance_ohm / params.motor_resistance_ohm;
+  battery_v = (params.battery_open_circuit_v + conductance_ratio * sum_duty_emf) /
+              (1.0 + conductance_ratio * sum_duty_squared);
+
+  for (int i = LEFT; i <= RIGHT; ++i)
+  {
+    Wheel &wheel = wheels[i];
+    wheel.current = (duty[i] * battery_v - emf[i]) / params.motor_resistance_ohm;
+    double previous_position = wheel.position;
+    double previous_omega = wheel.omega;
+    stepMechanics(wheel, d_t_sec);
+    wheel.position += 0.5 * (previous_omega + wheel.omega) * d_t_sec * TICKS_PER_RADIAN;
+    reportTicks(wheel, i, previous_position, on_tick);
+  }
+}
+
+int PlantModel::command(int wheel) const
+{
+  return wheels[wheel].command;
+}
+
+double PlantModel::speed(int wheel) const
+{
+  return wheels[wheel].omega * WHEEL_RADIUS;
+}
+
+double PlantModel::current(int wheel) const
+{
+  return wheels[wheel].current;
+}
+
+double PlantModel::batteryVolts() const
+{
+  return battery_v;
+}
+
+double PlantModel::dutyCycle(int command) const
+{
+  return std::abs(command) <= params.deadzone ? 0.0 : command / FULL_COMMAND;
+}
+
+/* Integrates the wheel speed. Coulomb friction holds a wheel at rest until the other torques exceed it, and
+ * can only bring a moving wheel to rest, never reverse it */
+void PlantModel::stepMechanics(Wheel &wheel, double d_t_sec) const
+{
+  double torque = params.motor_constant * GEAR_RATIO * wheel.current - params.viscous_friction * wheel.omega -
+                  wheel.load;
+  if (wheel.omega == 0.0 && std::abs(torque) <= params.coulomb_friction)
+  {
+    return;
+  }
+  double moving_direction = wheel.omega != 0.0 ? wheel.omega : torque;
+  torque -= std::copysign(params.coulomb_friction, moving_direction);
+  double omega = wheel.omega + torque * d_t_sec / params.inertia;
+  wheel.omega = wheel.omega != 0.0 && omega * wheel.omega < 0.0 ? 0.0 : omega;
+}
+
+/* Reports every tick boundary the position crossed during the step, where along the step it was crossed */
+void PlantModel::reportTicks(Wheel &wheel, int index, double previous_position, const TickCallback &on_tick)
+{
+  while (wheel.position >= static_cast<double>(wheel.ticks + 1))
+  {
+    ++wheel.ticks;
+    if (on_tick)
+    {
+      on_tick(index, 1, (static_cast<double>(wheel.ticks) - previous_position) / (wheel.position - previous_position));
+    }
+  }
+  while (wheel.position < static_cast<double>(wheel.ticks))
+  {
+    if (on_tick)
+    {
+      on_tick(index, -1, (previous_position - static_cast<double>(wheel.ticks)) / (previous_position - wheel.position));
+    }
+    --wheel.ticks;
+  }
+}
@@ -0,0 +1,91 @@
+#ifndef PLANT_MODEL_H
+#define PLANT_MODEL_H
+
+#include <cstdint>
+#include <functional>
+
+/* Physical constants of the simulated drive train. The defaults give about 1.9 m/s at full command and a
+ * mechanical time constant of about 0.2 s, in line with what system identification measures on the robot */
+struct PlantParams
+{
+  /* battery: an open circuit voltage behind an internal resistance */
+  double battery_open_circuit_v = 25.4;  // a charged 24 V lead-acid pack
+  double battery_resistance_ohm = 0.04;
+
+  /* Sabertooth */
+  int deadzone = 2;  // commands of this magnitude or less apply no voltage
+
+  /* motors, at the motor shaft */
+  double motor_resistance_ohm = 0.6;
+  double motor_constant = 0.065;  // back EMF in V s/rad, which is also the torque constant in N m/A
+
+  /* load of each motor, at the wheel */
+  double inertia = 1.46;          // kg m^2: half of a 90 kg robot at the wheel radius, plus the rotor
+  double viscous_friction = 0.5;  // N m s/rad
+  double coulomb_friction = 3.0;  // N m, also the torque needed to break away from standstill
+};
+
+/**
+ * The drive train as the firmware sees it from its pins, for the native builds: the Sabertooth, two DC motors
+ * driving the robot's inertia through the gearbox, the battery that powers them, and the motor shaft encoders.
+ *
+ * The Sabertooth takes the simplified serial bytes the firmware writes and turns each motor's 7-bit command
+ * into a share of the battery voltage. It brakes regeneratively, so the armature sees that voltage in every
+ * quadrant, and current flows back into the battery while braking. The armature inductance is left out, as
+ * its time constant is about a millisecond, well below the control period. The battery sags with the current
+ * the motors draw.
+ *
+ * Wheels are indexed LEFT and RIGHT. Not thread-safe.
+ */
+class PlantModel
+{
+public:
+  static constexpr int LEFT = 0;
+  static constexpr int RIGHT = 1;
+
+  /*
+  Called for every encoder tick passed during a step.
+  @param[in] wheel LEFT or RIGHT
+  @param[in] direction +1 forward, -1 backward
+  @param[in] fraction of the step that had passed at the tick, in [0, 1]
+  */
+  using TickCallback = std::function<void(int wheel, int direction, double fraction)>;
+
+  explicit PlantModel(const PlantParams &params = PlantParams());
+
+  /* One byte of Sabertooth simplified serial, as written by SaberToothController */
+  void receiveSabertooth(uint8_t byte);
+  /* Torque opposing forward motion at the wheel, N m, e.g. from a slope */
+  void setLoadTorque(int wheel, double torque);
+
+  void step(double d_t_sec, const TickCallback &on_tick);
+
+  /* Sabertooth command, -64 to 63 */
+  int command(int wheel) const;
+  /* Ground speed of the wheel, m/s */
+  double speed(int wheel) const;
+  /* Armature current, A */
+  double current(int wheel) const;
+  double batteryVolts() const;
+
+private:
+  struct Wheel
+  {
+    int command = 0;
+    double omega = 0.0;     // rad/s at the wheel
+    double current = 0.0;   // A
+    double position = 0.0;  // encoder ticks
+    int64_t ticks = 0;      // floor(position), the last tick reported
+    double load = 0.0;      // N m
+  };
+
+  double dutyCycle(int command) const;
+  void stepMechanics(Wheel &wheel, double d_t_sec) const;
+  static void reportTicks(Wheel &wheel, int index, double previous_position, const TickCallback &on_tick);
+
+  PlantParams params;
+  Wheel wheels[2];
+  double battery_v;
+};
+
+#endif  // PLANT_MODEL_H
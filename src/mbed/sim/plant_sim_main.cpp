@@ -0,0 +1,320 @@
+#include <getopt.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "sim/control_scenario.h"
+
+/*
+igvc-plant-sim: runs the firmware's velocity loop against the simulated drive train through a table of
+scenarios, faster than real time, and reports rise time, overshoot, steady state error and tracking RMS of
+each. Exits with 1 if any scenario is beyond its limits, so that control regressions fail the build. See
+--help.
+*/
+
+namespace
+{
+struct Options
+{
+  bool fixed_point = true;
+  std::string filter;
+  int random_runs = 0;
+  unsigned seed = 1;
+  std::string csv_path;
+  std::string trace_name;
+  std::string trace_path;
+  bool verbose = false;
+};
+
+/* Each control law with gains tuned by hand on the default plant */
+struct Law
+{
+  const char *name;
+  ControllerType type;
+  PIDCoeffs gains;
+};
+
+PIDCoeffs makeGains(float k_p, float k_i, float k_d, float k_kv, float k_a)
+{
+  PIDCoeffs gains;
+  gains.k_p = k_p;
+  gains.k_i = k_i;
+  gains.k_d = k_d;
+  gains.k_kv = k_kv;
+  gains.k_a = k_a;
+  return gains;
+}
+
+const Law LAWS[] = {
+  { "pid", ControllerType_CONTROLLER_PID, makeGains(60.0f, 120.0f, 0.0f, 33.0f, 0.0f) },
+  { "pi", ControllerType_CONTROLLER_PI_BACK_CALC, makeGains(60.0f, 200.0f, 0.0f, 33.0f, 0.0f) },
+  { "ff", ControllerType_CONTROLLER_FEEDFORWARD, makeGains(60.0f, 120.0f, 0.0f, 33.0f, 6.0f) },
+  { "lqr", ControllerType_CONTROLLER_LQR, makeGains(60.0f, 150.0f, 0.0f, 33.0f, 0.0f) },
+};
+
+/* Limit of a metric that doesn't apply to the case */
+constexpr double ANY = 1e9;
+
+SetpointProfile makeStep(float initial, float target)
+{
+  SetpointProfile setpoint;
+  setpoint.initial = initial;
+  setpoint.target = target;
+  return setpoint;
+}
+
+SetpointProfile makeShape(SetpointProfile::Shape shape, float initial, float target, double period_sec)
+{
+  SetpointProfile setpoint = makeStep(initial, target);
+  setpoint.shape = shape;
+  setpoint.period_sec = period_sec;
+  return setpoint;
+}
+
+/* What every control law is run through. The limits are those of the worst law with the gains above, plus a
+ * margin */
+std::vector<Scenario> buildCases()
+{
+  std::vector<Scenario> cases;
+  auto add = [&cases](const char *name, const SetpointProfile &setpoint, const ScenarioLimits &limits) -> Scenario & {
+    cases.emplace_back();
+    cases.back().name = name;
+    cases.back().setpoint = setpoint;
+    cases.back().limits = limits;
+    return cases.back();
+  };
+  using Shape = SetpointProfile::Shape;
+
+  add("step_0.5", makeStep(0.0f, 0.5f), { 0.20, 0.10, 0.01, 0.09 });
+  add("step_1.0", makeStep(0.0f, 1.0f), { 0.25, 0.15, 0.02, 0.18 });
+  // saturates the command for most of the rise
+  add("step_1.5", makeStep(0.0f, 1.5f), { 0.40, 0.20, 0.04, 0.35 });
+  add("step_down", makeStep(1.5f, 0.5f), { 0.40, 0.20, 0.015, 0.20 });
+  add("stop", makeStep(1.0f, 0.0f), { 0.22, 0.05, 0.01, 0.17 });
+  add("reverse", makeStep(1.0f, -1.0f), { 0.32, 0.15, 0.025, 0.40 });
+  // a couple of ticks per period, timed between edges
+  add("crawl", makeStep(0.0f, 0.3f), { 0.20, 0.12, 0.01, 0.05 });
+  add("ramp", makeShape(Shape::RAMP, 0.0f, 1.5f, 1.0), { ANY, ANY, 0.03, 0.08 });
+  add("sine", makeShape(Shape::SINE, 0.8f, 0.5f, 1.0), { ANY, ANY, ANY, 0.19 });
+  // the right wheel backwards at half the speed
+  add("turn", makeStep(0.0f, 1.0f), { 0.22, 0.15, 0.015, 0.18 }).setpoint.right_scale = -0.5f;
+  // driving onto a 15 degree slope, which takes about 20 N m per wheel
+  Scenario &slope = add("slope", makeStep(0.0f, 1.0f), { 0.22, 0.15, 0.04, 0.20 });
+  slope.load_torque = 20.0;
+  slope.load_start_sec = 1.5;
+  // a battery close to empty, which also sags further under load
+  add("low_battery", makeStep(0.0f, 1.5f), { 0.55, 0.18, 0.04, 0.37 }).plant.battery_open_circuit_v = 23.0;
+  // a payload of half the robot's mass
+  add("heavy", makeStep(0.0f, 1.0f), { 0.32, 0.18, 0.02, 0.22 }).plant.inertia *= 1.5;
+  return cases;
+}
+
+/* Every control law through every case */
+std::vector<Scenario> buildScenarios()
+{
+  std::vector<Scenario> scenarios;
+  for (const Law &law : LAWS)
+  {
+    for (Scenario scenario : buildCases())
+    {
+      scenario.name = std::string(law.name) + "/" + scenario.name;
+      scenario.controller = law.type;
+      scenario.gains = law.gains;
+      scenarios.push_back(scenario);
+    }
+  }
+  return scenarios;
+}
+
+/*
+Variants of the table on plants drawn around the default one, for robustness sweeps. Their limits are the
+table's, loosened, as a plant this different would also be tuned differently.
+*/
+std::vector<Scenario> randomizeScenarios(const std::vector<Scenario> &table, int count, unsigned seed)
+{
+  std::mt19937 generator(seed);
+  std::uniform_int_distribution<size_t> pick(0, table.size() - 1);
+  std::uniform_real_distribution<double> spread(-1.0, 1.0);
+  std::uniform_int_distribution<int> deadzone(0, 4);
+
+  std::vector<Scenario> scenarios;
+  for (int i = 0; i < count; ++i)
+  {
+    Scenario scenario = table[pick(generator)];
+    scenario.name += "#" + std::to_string(i);
+    PlantParams &plant = scenario.plant;
+    plant.battery_open_circuit_v = 24.2 + 1.6 * spread(generator);
+    plant.battery_resistance_ohm *= 1.0 + 0.5 * spread(generator);
+    plant.deadzone = deadzone(generator);
+    plant.motor_resistance_ohm *= 1.0 + 0.2 * spread(generator);
+    plant.motor_constant *= 1.0 + 0.1 * spread(generator);
+    plant.inertia *= 1.0 + 0.3 * spread(generator);
+    plant.viscous_friction *= 1.0 + 0.5 * spread(generator);
+    plant.coulomb_friction *= 1.0 + 0.5 * spread(generator);
+
+    ScenarioLimits &limits = scenario.limits;
+    limits.rise_sec *= 1.5;
+    limits.overshoot += 0.1;
+    limits.steady_state_error *= 1.5;
+    limits.tracking_rms *= 1.5;
+    scenarios.push_back(scenario);
+  }
+  return scenarios;
+}
+
+bool writeTrace(const std::string &path, const std::vector<TraceSample> &trace)
+{
+  FILE *file = fopen(path.c_str(), "w");
+  if (file == nullptr)
+  {
+    return false;
+  }
+  fprintf(file, "time_sec,desired_l,desired_r,estimate_l,estimate_r,speed_l,speed_r,command_l,command_r,battery_v\n");
+  for (const TraceSample &sample : trace)
+  {
+    fprintf(file, "%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%d,%d,%.3f\n", sample.time_sec, sample.desired_l,
+            sample.desired_r, sample.estimate_l, sample.estimate_r, sample.speed_l, sample.speed_r, sample.command_l,
+            sample.command_r, sample.battery_v);
+  }
+  return fclose(file) == 0;
+}
+
+void printUsage(const char *name)
+{
+  printf("Usage: %s [options]\n"
+         "  -f, --filter TEXT      only run scenarios whose name contains TEXT\n"
+         "  -F, --float            run the control law in float instead of the firmware's fixed point\n"
+         "  -r, --random N         also run N variants of the table on randomly perturbed plants\n"
+         "  -s, --seed N           seed of the perturbations (default 1)\n"
+         "  -c, --csv FILE         write the metrics of every scenario to FILE\n"
+         "  -t, --trace NAME=FILE  write every control period of scenario NAME to FILE\n"
+         "  -v, --verbose          print every scenario, not only the failed ones\n",
+         name);
+}
+
+bool parseOptions(int argc, char **argv, Options &options)
+{
+  static const option long_options[] = {
+    { "filter", required_argument, nullptr, 'f' }, { "float", no_argument, nullptr, 'F' },
+    { "random", required_argument, nullptr, 'r' }, { "seed", required_argument, nullptr, 's' },
+    { "csv", required_argument, nullptr, 'c' },    { "trace", required_argument, nullptr, 't' },
+    { "verbose", no_argument, nullptr, 'v' },      { "help", no_argument, nullptr, 'h' },
+    { nullptr, 0, nullptr, 0 },
+  };
+  int opt;
+  while ((opt = getopt_long(argc, argv, "f:Fr:s:c:t:vh", long_options, nullptr)) != -1)
+  {
+    switch (opt)
+    {
+      case 'f':
+        options.filter = optarg;
+        break;
+      case 'F':
+        options.fixed_point = false;
+        break;
+      case 'r':
+        options.random_runs = atoi(optarg);
+        break;
+      case 's':
+        options.seed = static_cast<unsigned>(strtoul(optarg, nullptr, 10));
+        break;
+      case 'c':
+        options.csv_path = optarg;
+        break;
+      case 't':
+      {
+        std::string argument = optarg;
+        size_t separator = argument.find('=');
+        if (separator == std::string::npos)
+        {
+          return false;
+        }
+        options.trace_name = argument.substr(0, separator);
+        options.trace_path = argument.substr(separator + 1);
+        break;
+      }
+      case 'v':
+        options.verbose = true;
+        break;
+      default:
+        return false;
+    }
+  }
+  return optind == argc && options.random_runs >= 0;
+}
+}  // namespace
+
+int main(int argc, char **argv)
+{
+  Options options;
+  if (!parseOptions(argc, argv, options))
+  {
+    printUsage(argv[0]);
+    return 2;
+  }
+
+  std::vector<Scenario> scenarios = buildScenarios();
+  std::vector<Scenario> variants = randomizeScenarios(scenarios, options.random_runs, options.seed);
+  scenarios.insert(scenarios.end(), variants.begin(), variants.end());
+
+  FILE *csv = nullptr;
+  if (!options.csv_path.empty())
+  {
+    csv = fopen(options.csv_path.c_str(), "w");
+    if (csv == nullptr)
+    {
+      fprintf(stderr, "Can't write %s\n", options.csv_path.c_str());
+      return 2;
+    }
+    fprintf(csv, "name,passed,rise_sec,overshoot,steady_state_error,tracking_rms,min_battery_v,max_current_a\n");
+  }
+
+  int runs = 0;
+  int failed = 0;
+  double simulated_sec = 0.0;
+  for (const Scenario &scenario : scenarios)
+  {
+    if (scenario.name.find(options.filter) == std::string::npos)
+    {
+      continue;
+    }
+    bool tracing = scenario.name == options.trace_name;
+    std::vector<TraceSample> trace;
+    ScenarioMetrics metrics = runScenario(scenario, options.fixed_point, tracing ? &trace : nullptr);
+    std::string failures;
+    bool passed = checkLimits(metrics, scenario.limits, failures);
+    ++runs;
+    failed += passed ? 0 : 1;
+    simulated_sec += scenario.duration_sec;
+
+    if (!passed || options.verbose)
+    {
+      printf("%-4s %-24s rise %6.3f s  overshoot %5.1f%%  steady %6.4f m/s  rms %6.4f m/s  battery %5.2f V%s%s\n",
+             passed ? "ok" : "FAIL", scenario.name.c_str(), metrics.rise_sec, metrics.overshoot * 100.0,
+             metrics.steady_state_error, metrics.tracking_rms, metrics.min_battery_v, passed ? "" : "  ",
+             failures.c_str());
+    }
+    if (csv != nullptr)
+    {
+      fprintf(csv, "%s,%d,%.5f,%.5f,%.5f,%.5f,%.3f,%.2f\n", scenario.name.c_str(), passed ? 1 : 0, metrics.rise_sec,
+              metrics.overshoot, metrics.steady_state_error, metrics.tracking_rms, metrics.min_battery_v,
+              metrics.max_current_a);
+    }
+    if (tracing && !writeTrace(options.trace_path, trace))
+    {
+      fprintf(stderr, "Can't write %s\n", options.trace_path.c_str());
+    }
+  }
+  if (csv != nullptr)
+  {
+    fclose(csv);
+  }
+
+  printf("%d of %d scenarios within limits, %.0f s simulated (%s control law)\n", runs - failed, runs, simulated_sec,
+         options.fixed_point ? "fixed point" : "float");
+  return failed == 0 ? 0 : 1;
+}
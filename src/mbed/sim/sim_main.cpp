@@ -0,0 +1,17 @@
+#include <csignal>
+
+#include "firmware.h"
+#include "sim/sim_world.h"
+
+/*
+Native build of the firmware. Serves the normal protocol on 127.0.0.1:SERVER_PORT while SimWorld
+plays the part of the motors and encoders. SIGUSR1 presses the e-stop switch, SIGUSR2 releases it.
+*/
+int main()
+{
+  SimWorld world;
+  world.start();
+  std::signal(SIGUSR1, [](int) { SimWorld::requestEstop(true); });
+  std::signal(SIGUSR2, [](int) { SimWorld::requestEstop(false); });
+  return runFirmware();
+}
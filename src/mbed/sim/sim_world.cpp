@@ -0,0 +1,96 @@
+#include "sim/sim_world.h"
+
+#include <chrono>
+
+#include "utils.h"
+
+namespace
+{
+/* world model constants */
+constexpr double SIM_STEP_SEC = 0.0005;
+constexpr PinName SABERTOOTH_TX = p13;
+constexpr PinName BATTERY_PIN = p19;
+
+/* ADC reading of the battery voltage through the p19 divider */
+float batteryReading(double volts)
+{
+  return static_cast<float>(volts * 1000.0 / BATTERY_FULL_SCALE_MV);
+}
+}  // namespace
+
+std::atomic<int> SimWorld::estop_request{ -1 };
+
+SimWorld::SimWorld() : encoders{ { p24, p23 }, { p26, p25 } }, running(false)
+{
+}
+
+SimWorld::~SimWorld()
+{
+  stop();
+}
+
+void SimWorld::start()
+{
+  /* e-stop released, battery charged */
+  hal::sim::setPin(p15, 1);
+  hal::sim::setAnalog(BATTERY_PIN, batteryReading(plant.batteryVolts()));
+
+  running = true;
+  worker = std::thread(&SimWorld::run, this);
+}
+
+void SimWorld::stop()
+{
+  running = false;
+  if (worker.joinable())
+  {
+    worker.join();
+  }
+}
+
+void SimWorld::run()
+{
+  auto next = std::chrono::steady_clock::now();
+  while (running)
+  {
+    next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(SIM_STEP_SEC));
+    std::this_thread::sleep_until(next);
+    step(SIM_STEP_SEC);
+  }
+}
+
+void SimWorld::requestEstop(bool pressed)
+{
+  estop_request = pressed ? 1 : 0;
+}
+
+void SimWorld::step(double d_t_sec)
+{
+  // the switch pulls p15 low when pressed
+  int request = estop_request.exchange(-1);
+  if (request >= 0)
+  {
+    hal::sim::setPin(p15, request == 1 ? 0 : 1);
+  }
+  for (uint8_t byte : hal::sim::takeSerialBytes(SABERTOOTH_TX))
+  {
+    plant.receiveSabertooth(byte);
+  }
+  // the edges are played at the end of the step, real time is not precise enough to place them within it
+  plant.step(d_t_sec, [this](int wheel, int direction, double) { emitTick(encoders[wheel], direction > 0); });
+  hal::sim::setAnalog(BATTERY_PIN, batteryReading(plant.batteryVolts()));
+}
+
+/*
+Play one full quadrature cycle. EncoderPair counts up when A == B on an edge of A, so B leads A when
+moving forward and lags it when moving backward.
+*/
+void SimWorld::emitTick(const Encoder &encoder, bool forward)
+{
+  PinName first = forward ? encoder.b : encoder.a;
+  PinName second = forward ? encoder.a : encoder.b;
+  hal::sim::setPin(first, 1);
+  hal::sim::setPin(second, 1);
+  hal::sim::setPin(first, 0);
+  hal::sim::setPin(second, 0);
+}
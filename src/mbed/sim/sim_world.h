@@ -0,0 +1,49 @@
+#ifndef SIM_WORLD_H
+#define SIM_WORLD_H
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "hal/hal.h"
+#include "sim/plant_model.h"
+
+/**
+ * Simulated robot for the native firmware build.
+ *
+ * Feeds the byte stream the firmware writes to the Sabertooth to a PlantModel in real time, plays the
+ * encoder ticks it produces back into the firmware's encoder pins and the battery voltage into its ADC.
+ */
+class SimWorld
+{
+public:
+  SimWorld();
+  SimWorld(const SimWorld &) = delete;
+  SimWorld &operator=(const SimWorld &) = delete;
+  ~SimWorld();
+  void start();
+  void stop();
+
+  /* Presses or releases the e-stop switch at the next step. Async-signal-safe, see sim_main.cpp */
+  static void requestEstop(bool pressed);
+
+private:
+  struct Encoder
+  {
+    PinName a;
+    PinName b;
+  };
+
+  void run();
+  void step(double d_t_sec);
+  static void emitTick(const Encoder &encoder, bool forward);
+
+  PlantModel plant;
+  Encoder encoders[2];
+  std::thread worker;
+  std::atomic<bool> running;
+  // 1 to press, 0 to release, -1 for no request
+  static std::atomic<int> estop_request;
+};
+
+#endif  // SIM_WORLD_H
@@ -0,0 +1,86 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Lock-free single-producer/single-consumer ring buffer, e.g. between an ISR and a thread.
+ *
+ * Only the producer writes head and only the consumer writes tail, so push() and pop() need no
+ * critical section. SIZE must be a power of two; the indices run freely and are masked on access.
+ */
+template <typename T, uint32_t SIZE>
+class SpscRing
+{
+public:
+  static_assert(SIZE > 0 && (SIZE & (SIZE - 1)) == 0, "SIZE must be a power of two");
+
+  /* Producer side. Returns false, dropping the element, when the ring is full */
+  bool push(const T &element)
+  {
+    uint32_t head_index = head.load(std::memory_order_relaxed);
+    if (head_index - tail.load(std::memory_order_acquire) == SIZE)
+    {
+      return false;
+    }
+    buffer[head_index & (SIZE - 1)] = element;
+    head.store(head_index + 1, std::memory_order_release);
+    return true;
+  }
+
+  /* Consumer side. Returns false when the ring is empty */
+  bool pop(T &element)
+  {
+    uint32_t tail_index = tail.load(std::memory_order_relaxed);
+    if (tail_index == head.load(std::memory_order_acquire))
+    {
+      return false;
+    }
+    element = buffer[tail_index & (SIZE - 1)];
+    tail.store(tail_index + 1, std::memory_order_release);
+    return true;
+  }
+
+  /* Consumer side. Reads the oldest element without removing it */
+  bool peek(T &element) const
+  {
+    uint32_t tail_index = tail.load(std::memory_order_relaxed);
+    if (tail_index == head.load(std::memory_order_acquire))
+    {
+      return false;
+    }
+    element = buffer[tail_index & (SIZE - 1)];
+    return true;
+  }
+
+  bool empty() const
+  {
+    return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+  }
+
+  uint32_t size() const
+  {
+    return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+  }
+
+  /* Drops all elements. Only safe while the consumer cannot run (e.g. in a critical section) */
+  void clear()
+  {
+    tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+  }
+
+  /* Empties the ring. Only safe while neither side can run, e.g. before either has started */
+  void reset()
+  {
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+  }
+
+private:
+  T buffer[SIZE];
+  std::atomic<uint32_t> head{ 0 };
+  std::atomic<uint32_t> tail{ 0 };
+};
+
+#endif  // SPSC_RING_H
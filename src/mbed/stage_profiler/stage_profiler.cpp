@@ -0,0 +1,41 @@
+#include "stage_profiler/stage_profiler.h"
+
+StageProfiler::StageProfiler()
+{
+  reset();
+}
+
+void StageProfiler::record(ProfileStage stage, uint32_t cycles)
+{
+  Stats &stats = stages[stage];
+  ++stats.count;
+  stats.total_cycles += cycles;
+  if (cycles < stats.min_cycles)
+  {
+    stats.min_cycles = cycles;
+  }
+  if (cycles > stats.max_cycles)
+  {
+    stats.max_cycles = cycles;
+  }
+
+  // floor(log2(cycles)), a single CLZ instruction on the Cortex-M3
+  int log2 = 31 - __builtin_clz(cycles | 1);
+  int bin = log2 - HISTOGRAM_SHIFT;
+  bin = bin < 0 ? 0 : (bin >= HISTOGRAM_BINS ? HISTOGRAM_BINS - 1 : bin);
+  ++stats.histogram[bin];
+}
+
+const StageProfiler::Stats &StageProfiler::stats(ProfileStage stage) const
+{
+  return stages[stage];
+}
+
+void StageProfiler::reset()
+{
+  for (Stats &stats : stages)
+  {
+    stats = Stats{};
+    stats.min_cycles = UINT32_MAX;
+  }
+}
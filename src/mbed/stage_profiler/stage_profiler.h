@@ -0,0 +1,43 @@
+#ifndef STAGE_PROFILER_H
+#define STAGE_PROFILER_H
+
+#include <cstdint>
+
+#include "igvc.pb.h"
+
+/**
+ * Cycle-count statistics of the stages of the firmware (see ProfileStage in the proto).
+ *
+ * Callers read hal::cycleCount() before and after a stage and pass the difference to record(), which
+ * only does a few adds, compares and a CLZ, so it can stay enabled in production. Each stage keeps
+ * min/max/mean and a log2 histogram until reset(). A stage must only be recorded from one thread, and
+ * reading the statistics of a stage recorded by another thread needs the lock that thread holds.
+ */
+class StageProfiler
+{
+public:
+  static constexpr int STAGE_COUNT = ProfileStage_STAGE_CONTROL_R + 1;
+  static constexpr int HISTOGRAM_BINS = 16;
+  // bin 0 holds everything below 2^(HISTOGRAM_SHIFT + 1) cycles
+  static constexpr int HISTOGRAM_SHIFT = 6;
+
+  struct Stats
+  {
+    uint32_t count;
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+    uint64_t total_cycles;
+    uint32_t histogram[HISTOGRAM_BINS];
+  };
+
+  StageProfiler();
+
+  void record(ProfileStage stage, uint32_t cycles);
+  const Stats &stats(ProfileStage stage) const;
+  void reset();
+
+private:
+  Stats stages[STAGE_COUNT];
+};
+
+#endif  // STAGE_PROFILER_H
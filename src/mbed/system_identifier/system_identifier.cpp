@@ -0,0 +1,349 @@
+#include "system_identifier/system_identifier.h"
+
+#include <cmath>
+
+#include "utils.h"
+
+namespace
+{
+constexpr float PI = 3.14159265f;
+constexpr float CHIRP_MIN_HZ = 0.1f;
+// fewer periods than this can't tell the time constant from noise
+constexpr uint32_t MIN_FIT_SAMPLES = 50;
+}  // namespace
+
+void FopdtFit::reset()
+{
+  *this = FopdtFit();
+  const float period_sec = static_cast<float>(CONTROL_PERIOD_US) * 1e-6f;
+  float time_constant = MIN_TIME_CONSTANT_SEC;
+  for (float &pole : poles)
+  {
+    pole = std::exp(-period_sec / time_constant);
+    time_constant *= TIME_CONSTANT_STEP;
+  }
+}
+
+void FopdtFit::add(float speed, float command)
+{
+  for (int d = 0; d < DEAD_PERIODS; ++d)
+  {
+    const float input = commands[d];
+    for (int j = 0; j < TIME_CONSTANTS; ++j)
+    {
+      float &x = outputs[d][j];
+      x = poles[j] * x + (1.0f - poles[j]) * input;
+      sum_xy[d][j] += x * speed;
+      sum_xx[d][j] += x * x;
+    }
+  }
+  sum_yy += speed * speed;
+  ++samples;
+
+  for (int i = DEAD_PERIODS - 1; i > 0; --i)
+  {
+    commands[i] = commands[i - 1];
+  }
+  commands[0] = command;
+}
+
+FopdtFit::Model FopdtFit::solve() const
+{
+  Model best{ false, 0.0f, 0.0f, 0.0f, 0.0f };
+  if (samples < MIN_FIT_SAMPLES)
+  {
+    return best;
+  }
+
+  // residual of the best gain at every grid point, sum_yy - sum_xy^2 / sum_xx
+  float residuals[DEAD_PERIODS][TIME_CONSTANTS];
+  int best_d = -1;
+  int best_j = -1;
+  for (int d = 0; d < DEAD_PERIODS; ++d)
+  {
+    for (int j = 0; j < TIME_CONSTANTS; ++j)
+    {
+      residuals[d][j] = sum_xx[d][j] > 0.0f ? sum_yy - sum_xy[d][j] * sum_xy[d][j] / sum_xx[d][j] : sum_yy;
+      // only a wheel that turns forward on a positive command
+      if (sum_xy[d][j] > 0.0f && (best_d < 0 || residuals[d][j] < residuals[best_d][best_j]))
+      {
+        best_d = d;
+        best_j = j;
+      }
+    }
+  }
+  if (best_d < 0)
+  {
+    return best;
+  }
+
+  // a parabola through the neighbours puts the time constant between grid points
+  float offset = 0.0f;
+  if (best_j > 0 && best_j < TIME_CONSTANTS - 1)
+  {
+    const float below = residuals[best_d][best_j - 1];
+    const float at = residuals[best_d][best_j];
+    const float above = residuals[best_d][best_j + 1];
+    const float curvature = below - 2.0f * at + above;
+    offset = curvature > 0.0f ? 0.5f * (below - above) / curvature : 0.0f;
+  }
+  const float residual = residuals[best_d][best_j];
+  best.valid = true;
+  best.gain = sum_xy[best_d][best_j] / sum_xx[best_d][best_j];
+  best.time_constant_sec = MIN_TIME_CONSTANT_SEC * std::pow(TIME_CONSTANT_STEP, static_cast<float>(best_j) + offset);
+  best.dead_time_sec = static_cast<float>(best_d * CONTROL_PERIOD_US) * 1e-6f;
+  best.rms = std::sqrt((residual > 0.0f ? residual : 0.0f) / static_cast<float>(samples));
+  return best;
+}
+
+void RelayAnalysis::reset()
+{
+  *this = RelayAnalysis();
+}
+
+bool RelayAnalysis::update(float setpoint, float speed, uint64_t now_us)
+{
+  float error = setpoint - speed;
+  if (!high && error > SYSID_RELAY_HYSTERESIS)
+  {
+    high = true;
+    // one cycle ends and the next starts at every switch to high
+    if (has_rise && ++cycles > SYSID_RELAY_SETTLE_CYCLES)
+    {
+      sum_period_us += static_cast<double>(now_us - last_rise_us);
+      sum_amplitude += (cycle_max - cycle_min) / 2.0f;
+      ++measured;
+    }
+    has_rise = true;
+    last_rise_us = now_us;
+    cycle_max = speed;
+    cycle_min = speed;
+  }
+  else if (high && error < -SYSID_RELAY_HYSTERESIS)
+  {
+    high = false;
+  }
+
+  cycle_max = speed > cycle_max ? speed : cycle_max;
+  cycle_min = speed < cycle_min ? speed : cycle_min;
+  return high;
+}
+
+bool RelayAnalysis::result(float relay_amplitude, float &ultimate_gain, float &ultimate_period_sec) const
+{
+  if (measured == 0)
+  {
+    return false;
+  }
+  auto amplitude = static_cast<float>(sum_amplitude / measured);
+  // describing function of a relay with hysteresis
+  float squared = amplitude * amplitude - SYSID_RELAY_HYSTERESIS * SYSID_RELAY_HYSTERESIS;
+  if (squared <= 0.0f)
+  {
+    return false;
+  }
+  ultimate_gain = 4.0f * relay_amplitude / (PI * std::sqrt(squared));
+  ultimate_period_sec = static_cast<float>(sum_period_us / measured * 1e-6);
+  return true;
+}
+
+void SystemIdentifier::start(const SysIdRequest &request, float kv_l, float kv_r, uint64_t now_us)
+{
+  const auto limit = static_cast<float>(MOTOR_COMMAND_LIMIT);
+  excitation = request.excitation;
+  amplitude = static_cast<float>(request.amplitude);
+  amplitude = amplitude > limit ? limit : amplitude;
+  offset = static_cast<float>(request.offset);
+  uint32_t duration_ms = request.duration_ms < SYSID_MAX_DURATION_MS ? request.duration_ms : SYSID_MAX_DURATION_MS;
+  duration_us = duration_ms * 1000ull;
+  chirp_max_hz = request.chirp_max_hz;
+  relay_speed = request.relay_speed;
+
+  start_us = now_us;
+  elapsed_us = 0;
+  prbs = 0x7f;
+  next_prbs_bit_us = 0;
+  left.fit.reset();
+  right.fit.reset();
+  left.relay.reset();
+  right.relay.reset();
+  left.relay_bias = offset + kv_l * relay_speed;
+  right.relay_bias = offset + kv_r * relay_speed;
+  left.model = WheelModel_init_zero;
+  right.model = WheelModel_init_zero;
+  run_state = SysIdState_SYSID_RUNNING;
+}
+
+void SystemIdentifier::abort()
+{
+  if (run_state == SysIdState_SYSID_RUNNING)
+  {
+    run_state = SysIdState_SYSID_ABORTED;
+  }
+}
+
+void SystemIdentifier::clear()
+{
+  run_state = SysIdState_SYSID_IDLE;
+}
+
+bool SystemIdentifier::running() const
+{
+  return run_state == SysIdState_SYSID_RUNNING;
+}
+
+SysIdState SystemIdentifier::state() const
+{
+  return run_state;
+}
+
+bool SystemIdentifier::update(uint64_t now_us, const WheelSpeed &speed_l, const WheelSpeed &speed_r, int &command_l,
+                              int &command_r)
+{
+  command_l = 0;
+  command_r = 0;
+  if (run_state != SysIdState_SYSID_RUNNING)
+  {
+    return false;
+  }
+  elapsed_us = now_us - start_us;
+  // the fits assume the wheels start at rest
+  bool moving = elapsed_us < CONTROL_PERIOD_US && (speed_l.counted != 0.0f || speed_r.counted != 0.0f);
+  if (moving || std::fabs(speed_l.counted) > SYSID_SPEED_LIMIT || std::fabs(speed_r.counted) > SYSID_SPEED_LIMIT)
+  {
+    run_state = SysIdState_SYSID_ABORTED;
+    return false;
+  }
+  if (elapsed_us >= duration_us)
+  {
+    finish(left);
+    finish(right);
+    run_state = SysIdState_SYSID_DONE;
+    return false;
+  }
+
+  if (excitation == SysIdExcitation_SYSID_PRBS && elapsed_us >= next_prbs_bit_us)
+  {
+    // x^7 + x^6 + 1, maximal length: 127 bits
+    uint32_t bit = ((prbs >> 6) ^ (prbs >> 5)) & 1u;
+    prbs = ((prbs << 1) | bit) & 0x7fu;
+    next_prbs_bit_us += SYSID_PRBS_BIT_US;
+  }
+  command_l = excite(left, speed_l, elapsed_us);
+  command_r = excite(right, speed_r, elapsed_us);
+  return true;
+}
+
+/* The command of one wheel for this period, which the wheel's fit also records */
+int SystemIdentifier::excite(Wheel &wheel, const WheelSpeed &speed, uint64_t elapsed)
+{
+  float command = offset;
+  switch (excitation)
+  {
+    case SysIdExcitation_SYSID_STEP:
+      command += elapsed >= duration_us / 4 ? amplitude : 0.0f;
+      break;
+    case SysIdExcitation_SYSID_PRBS:
+      command += (prbs & 1u) ? amplitude : -amplitude;
+      break;
+    case SysIdExcitation_SYSID_CHIRP:
+    {
+      // linear sweep, the phase is the integral of the frequency
+      float t = static_cast<float>(elapsed) * 1e-6f;
+      float length = static_cast<float>(duration_us) * 1e-6f;
+      float phase = 2.0f * PI * (CHIRP_MIN_HZ * t + (chirp_max_hz - CHIRP_MIN_HZ) * t * t / (2.0f * length));
+      command += amplitude * std::sin(phase);
+      break;
+    }
+    case SysIdExcitation_SYSID_RELAY:
+      command = wheel.relay_bias + (wheel.relay.update(relay_speed, speed.estimated, elapsed) ? amplitude : -amplitude);
+      break;
+  }
+
+  const auto limit = static_cast<float>(MOTOR_COMMAND_LIMIT);
+  command = command > limit ? limit : (command < -limit ? -limit : command);
+  int rounded = roundToInt(command);
+  wheel.fit.add(speed.counted, static_cast<float>(rounded));
+  return rounded;
+}
+
+/* Fills in the wheel's model and proposed gains at the end of a run */
+void SystemIdentifier::finish(Wheel &wheel)
+{
+  WheelModel &model = wheel.model;
+  const FopdtFit::Model fit = wheel.fit.solve();
+  model.has_valid = true;
+  model.valid = fit.valid;
+
+  bool has_gains = false;
+  float k_p = 0.0f;
+  float t_i = 0.0f;
+  float t_d = 0.0f;
+  if (fit.valid)
+  {
+    const float k = fit.gain;
+    const float tau = fit.time_constant_sec;
+    const float theta = fit.dead_time_sec;
+    model.has_gain = true;
+    model.has_time_constant_sec = true;
+    model.has_dead_time_sec = true;
+    model.has_fit_rms = true;
+    model.has_kv = true;
+    model.gain = k;
+    model.time_constant_sec = tau;
+    model.dead_time_sec = theta;
+    model.fit_rms = fit.rms;
+    model.kv = 1.0f / k;
+
+    // IMC PID for a first order plus dead time plant, with closed loop time constant lambda
+    float lambda = SYSID_IMC_LAMBDA_RATIO * tau;
+    lambda = lambda > theta ? lambda : theta;
+    k_p = (2.0f * tau + theta) / (k * (2.0f * lambda + theta));
+    t_i = tau + theta / 2.0f;
+    t_d = tau * theta / (2.0f * tau + theta);
+    has_gains = true;
+  }
+
+  float ultimate_gain = 0.0f;
+  float ultimate_period = 0.0f;
+  if (excitation == SysIdExcitation_SYSID_RELAY && wheel.relay.result(amplitude, ultimate_gain, ultimate_period))
+  {
+    model.has_ultimate_gain = true;
+    model.has_ultimate_period_sec = true;
+    model.ultimate_gain = ultimate_gain;
+    model.ultimate_period_sec = ultimate_period;
+    // Tyreus-Luyben, less overshoot than Ziegler-Nichols
+    k_p = ultimate_gain / 2.2f;
+    t_i = 2.2f * ultimate_period;
+    t_d = ultimate_period / 6.3f;
+    has_gains = true;
+  }
+
+  if (has_gains)
+  {
+    model.has_p = true;
+    model.has_i = true;
+    model.has_d = true;
+    model.p = k_p;
+    model.i = k_p / t_i;
+    model.d = k_p * t_d;
+  }
+}
+
+void SystemIdentifier::fillStatus(SysIdStatus &status, uint64_t now_us) const
+{
+  status.has_state = true;
+  status.state = run_state;
+  status.has_excitation = true;
+  status.excitation = excitation;
+  status.has_elapsed_ms = true;
+  uint64_t elapsed = run_state == SysIdState_SYSID_RUNNING ? now_us - start_us : elapsed_us;
+  status.elapsed_ms = static_cast<uint32_t>(elapsed / 1000);
+  if (run_state == SysIdState_SYSID_DONE)
+  {
+    status.has_left = true;
+    status.has_right = true;
+    status.left = left.model;
+    status.right = right.model;
+  }
+}
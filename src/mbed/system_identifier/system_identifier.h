@@ -0,0 +1,149 @@
+#ifndef SYSTEM_IDENTIFIER_H
+#define SYSTEM_IDENTIFIER_H
+
+#include <cstdint>
+
+#include "igvc.pb.h"
+
+/**
+ * Fit of a first order plus dead time model, speed = gain * e^(-dead_time s) / (time_constant s + 1) * command,
+ * to the commands and speeds of one wheel.
+ *
+ * It is an output error fit: for every time constant and dead time of a grid the model is simulated at unit
+ * gain alongside the wheel, and the gain that fits best follows by linear least squares. Unlike fitting a
+ * difference equation to the measured speeds, this isn't biased by the speed's noise and quantization. The
+ * sums are kept online, so the fit takes constant memory whatever the excitation; solve() picks the best
+ * grid point and refines the time constant between its neighbours. The wheel must be at rest at the start.
+ */
+class FopdtFit
+{
+public:
+  static constexpr int TIME_CONSTANTS = 16;  // MIN_TIME_CONSTANT_SEC * TIME_CONSTANT_STEP^j
+  static constexpr int DEAD_PERIODS = 5;     // 0 to 4 control periods
+
+  struct Model
+  {
+    bool valid;
+    float gain;
+    float time_constant_sec;
+    float dead_time_sec;
+    float rms;
+  };
+
+  void reset();
+  /* The speed measured this period, then the command sent in it */
+  void add(float speed, float command);
+  Model solve() const;
+
+private:
+  static constexpr float MIN_TIME_CONSTANT_SEC = 0.01f;
+  static constexpr float TIME_CONSTANT_STEP = 1.4f;
+
+  float poles[TIME_CONSTANTS]{};                  // e^(-T / time constant)
+  float commands[DEAD_PERIODS]{};                 // commands[i] was sent i + 1 periods ago
+  float outputs[DEAD_PERIODS][TIME_CONSTANTS]{};  // the models at unit gain
+  float sum_xy[DEAD_PERIODS][TIME_CONSTANTS]{};   // model times speed
+  float sum_xx[DEAD_PERIODS][TIME_CONSTANTS]{};
+  float sum_yy = 0.0f;
+  uint32_t samples = 0;
+};
+
+/**
+ * Measures the limit cycle of one wheel under relay feedback (Astrom-Hagglund): its period and the amplitude
+ * of the speed. The first SYSID_RELAY_SETTLE_CYCLES cycles are left out as the start transient.
+ */
+class RelayAnalysis
+{
+public:
+  void reset();
+  /* @return whether the relay is high, i.e. the speed is below setpoint - hysteresis or was and hasn't
+   * risen above setpoint + hysteresis since */
+  bool update(float setpoint, float speed, uint64_t now_us);
+  /* @return false until at least one full cycle was measured */
+  bool result(float relay_amplitude, float &ultimate_gain, float &ultimate_period_sec) const;
+
+private:
+  bool high = true;
+  bool has_rise = false;
+  uint64_t last_rise_us = 0;
+  float cycle_max = 0.0f;
+  float cycle_min = 0.0f;
+  uint32_t cycles = 0;
+  uint32_t measured = 0;
+  double sum_period_us = 0.0;
+  double sum_amplitude = 0.0;
+};
+
+/**
+ * On-board system identification of both wheels.
+ *
+ * A run drives both motors with the same excitation (see SysIdExcitation) instead of the controllers, while
+ * FopdtFit records every control period. It has to start with the wheels at rest. The relay excitation
+ * closes the loop around a speed setpoint and RelayAnalysis measures the ultimate gain and period on top. At
+ * the end each wheel gets a model and proposed gains: Tyreus-Luyben PID rules from the relay experiment, IMC
+ * PID rules from the model otherwise, and kv = 1 / gain either way. Nothing is applied; the host decides.
+ *
+ * The excitation is bounded by MOTOR_COMMAND_LIMIT, and the run is aborted as soon as a wheel exceeds
+ * SYSID_SPEED_LIMIT. The fits cost about 500 float operations per period, fine for a tuning mode.
+ */
+class SystemIdentifier
+{
+public:
+  /*
+  Starts a run, replacing any earlier one.
+  @param[in] kv_l, kv_r current velocity feed forward of the wheels, the relay is centred on kv * relay_speed
+  */
+  void start(const SysIdRequest &request, float kv_l, float kv_r, uint64_t now_us);
+  void abort();
+  /* Back to idle, forgetting the results */
+  void clear();
+
+  bool running() const;
+  SysIdState state() const;
+
+  /* What is known about the speed of a wheel in one control period */
+  struct WheelSpeed
+  {
+    float counted;    // ticks of the period over its length, for the fit: noisy but without lag or outliers
+    float estimated;  // VelocityEstimator's, what the controllers see, for the relay
+  };
+
+  /*
+  Call once per control period while running().
+  @param[out] command_l, command_r motor commands for this period, before the Sabertooth's own clamping
+  @return false once the run has ended, at which point the commands are 0
+  */
+  bool update(uint64_t now_us, const WheelSpeed &speed_l, const WheelSpeed &speed_r, int &command_l,
+              int &command_r);
+
+  void fillStatus(SysIdStatus &status, uint64_t now_us) const;
+
+private:
+  struct Wheel
+  {
+    FopdtFit fit;
+    RelayAnalysis relay;
+    float relay_bias;
+    WheelModel model;
+  };
+
+  int excite(Wheel &wheel, const WheelSpeed &speed, uint64_t elapsed_us);
+  void finish(Wheel &wheel);
+
+  SysIdState run_state = SysIdState_SYSID_IDLE;
+  SysIdExcitation excitation = SysIdExcitation_SYSID_STEP;
+  float amplitude = 0.0f;
+  float offset = 0.0f;
+  uint64_t duration_us = 0;
+  float chirp_max_hz = 0.0f;
+  float relay_speed = 0.0f;
+
+  uint64_t start_us = 0;
+  uint64_t elapsed_us = 0;
+  uint32_t prbs = 0;  // LFSR state
+  uint64_t next_prbs_bit_us = 0;
+  Wheel left{};
+  Wheel right{};
+};
+
+#endif  // SYSTEM_IDENTIFIER_H
@@ -0,0 +1,71 @@
+#include "telemetry_schedule/telemetry_schedule.h"
+
+TelemetrySchedule::TelemetrySchedule()
+{
+  reset();
+}
+
+void TelemetrySchedule::reset()
+{
+  mask = DEFAULT_GROUPS;
+  for (int group = 0; group < GROUP_COUNT; ++group)
+  {
+    divisor[group] = 1;
+    countdown[group] = 1;
+  }
+  gains_changed = true;
+}
+
+void TelemetrySchedule::configure(const RequestMessage &request)
+{
+  if (!request.has_telemetry_mask)
+  {
+    return;
+  }
+
+  mask = request.telemetry_mask & ALL_GROUPS;
+  for (int group = 0; group < GROUP_COUNT; ++group)
+  {
+    uint32_t requested = group < request.telemetry_divisor_count ? request.telemetry_divisor[group] : 0;
+    divisor[group] = requested == 0 ? 1 : requested;
+    // every subscribed group goes out in the next response, then at its own rate
+    countdown[group] = 1;
+  }
+  gains_changed = true;
+}
+
+void TelemetrySchedule::markGainsChanged()
+{
+  gains_changed = true;
+}
+
+uint32_t TelemetrySchedule::nextResponse()
+{
+  uint32_t due = 0;
+  for (int group = 0; group < GROUP_COUNT; ++group)
+  {
+    if (!contains(mask, static_cast<TelemetryGroup>(group)))
+    {
+      continue;
+    }
+    if (group == TelemetryGroup_TELEMETRY_GAINS)
+    {
+      if (gains_changed)
+      {
+        due |= uint32_t{ 1 } << group;
+        gains_changed = false;
+      }
+    }
+    else if (--countdown[group] == 0)
+    {
+      due |= uint32_t{ 1 } << group;
+      countdown[group] = divisor[group];
+    }
+  }
+  return due;
+}
+
+bool TelemetrySchedule::subscribed(TelemetryGroup group) const
+{
+  return contains(mask, group);
+}
@@ -0,0 +1,48 @@
+#ifndef TELEMETRY_SCHEDULE_H
+#define TELEMETRY_SCHEDULE_H
+
+#include <cstdint>
+
+#include "igvc.pb.h"
+
+/**
+ * Decides which groups of ResponseMessage fields go into each response.
+ *
+ * The host subscribes to groups with RequestMessage.telemetry_mask and slows each group down with a rate
+ * divisor, e.g. speeds in every response but the voltage only in every 50th. The gains are only sent
+ * when they changed since they were last sent.
+ */
+class TelemetrySchedule
+{
+public:
+  static constexpr int GROUP_COUNT = TelemetryGroup_TELEMETRY_DIAGNOSTICS + 1;
+  static constexpr uint32_t ALL_GROUPS = (uint32_t{ 1 } << GROUP_COUNT) - 1;
+  // diagnostics are expensive to collect and only sent on request
+  static constexpr uint32_t DEFAULT_GROUPS = ALL_GROUPS & ~(uint32_t{ 1 } << TelemetryGroup_TELEMETRY_DIAGNOSTICS);
+
+  TelemetrySchedule();
+
+  /* DEFAULT_GROUPS in every response, until the host subscribes */
+  void reset();
+  /* Applies the request's subscription, if it has one */
+  void configure(const RequestMessage &request);
+  void markGainsChanged();
+
+  /* The groups due in the next response, as a mask. Call once per response */
+  uint32_t nextResponse();
+  /* Whether the host subscribed to the group at all, whatever its divisor */
+  bool subscribed(TelemetryGroup group) const;
+
+  static bool contains(uint32_t groups, TelemetryGroup group)
+  {
+    return (groups & (uint32_t{ 1 } << group)) != 0;
+  }
+
+private:
+  uint32_t mask;
+  uint32_t divisor[GROUP_COUNT];
+  uint32_t countdown[GROUP_COUNT];
+  bool gains_changed;
+};
+
+#endif  // TELEMETRY_SCHEDULE_H
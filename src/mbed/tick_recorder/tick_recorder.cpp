@@ -0,0 +1,72 @@
+#include "tick_recorder/tick_recorder.h"
+
+void TickRecorder::init()
+{
+  ring.reset();
+  recording.store(false, std::memory_order_relaxed);
+  dropped.store(0, std::memory_order_relaxed);
+  period_us = 0;
+  last_push_us = 0;
+}
+
+void TickRecorder::record(const TickRecord &record)
+{
+  if (recording.load(std::memory_order_relaxed) && !ring.push(record))
+  {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void TickRecorder::setPushPeriod(uint32_t period_ms)
+{
+  period_us = period_ms * 1000;
+  recording.store(period_ms != 0, std::memory_order_relaxed);
+  if (period_ms == 0)
+  {
+    ring.clear();
+    dropped.store(0, std::memory_order_relaxed);
+  }
+}
+
+bool TickRecorder::pushDue(uint64_t now_us)
+{
+  if (period_us == 0 || now_us - last_push_us < period_us)
+  {
+    return false;
+  }
+  last_push_us = now_us;
+  return true;
+}
+
+uint32_t TickRecorder::pending() const
+{
+  return ring.size();
+}
+
+void TickRecorder::fillSamples(ResponseMessage &response, uint64_t now_us)
+{
+  TickRecord record;
+  response.samples_count = 0;
+  while (response.samples_count < BATCH_SIZE && ring.pop(record))
+  {
+    TickSample &sample = response.samples[response.samples_count++];
+    sample = TickSample_init_zero;
+    sample.has_time_us = true;
+    sample.has_speed_l = true;
+    sample.has_speed_r = true;
+    sample.has_desired_speed_l = true;
+    sample.has_desired_speed_r = true;
+    sample.has_left_output = true;
+    sample.has_right_output = true;
+    // signed, as ticks recorded since now_us was read are newer than it
+    sample.time_us = now_us + static_cast<int32_t>(record.time_us - static_cast<uint32_t>(now_us));
+    sample.speed_l = toFloat(record.speed_l);
+    sample.speed_r = toFloat(record.speed_r);
+    sample.desired_speed_l = toFloat(record.desired_speed_l);
+    sample.desired_speed_r = toFloat(record.desired_speed_r);
+    sample.left_output = record.left_output;
+    sample.right_output = record.right_output;
+  }
+  response.has_dropped_samples = true;
+  response.dropped_samples = dropped.exchange(0, std::memory_order_relaxed);
+}
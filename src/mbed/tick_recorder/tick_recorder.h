@@ -0,0 +1,61 @@
+#ifndef TICK_RECORDER_H
+#define TICK_RECORDER_H
+
+#include <atomic>
+#include <cstdint>
+
+#include "igvc.pb.h"
+#include "spsc_ring/spsc_ring.h"
+#include "utils.h"
+
+/* What the control thread records of one tick. Kept in ControlScalar so recording costs no float math, and
+ * with only the low 32 bits of the clock so that it stays 24 bytes and the ring fits in AHBSRAM0 */
+struct TickRecord
+{
+  uint32_t time_us;
+  ControlScalar speed_l;
+  ControlScalar speed_r;
+  ControlScalar desired_speed_l;
+  ControlScalar desired_speed_r;
+  uint8_t left_output;
+  uint8_t right_output;
+};
+
+/**
+ * Records every control tick for push telemetry.
+ *
+ * The control thread is the producer and the network thread the consumer. The network thread turns
+ * recording on and off with setPushPeriod() and drains the ring into ResponseMessage.samples when
+ * pushDue() says so.
+ */
+class TickRecorder
+{
+public:
+  static constexpr uint32_t BATCH_SIZE = sizeof(ResponseMessage{}.samples) / sizeof(TickSample);
+
+  /* Puts the recorder into its initial state. Needed when it is placed in memory the startup code doesn't
+   * zero; call before the control thread starts */
+  void init();
+
+  /* Producer side. Does nothing while pushing is off */
+  void record(const TickRecord &record);
+
+  /* Consumer side. 0 stops recording and drops what was recorded */
+  void setPushPeriod(uint32_t period_ms);
+  bool pushDue(uint64_t now_us);
+  uint32_t pending() const;
+  /*
+  Moves up to BATCH_SIZE ticks into the response.
+  @param[in] now_us the clock, to widen the recorded times again. Ticks are at most a few seconds from it
+  */
+  void fillSamples(ResponseMessage &response, uint64_t now_us);
+
+private:
+  SpscRing<TickRecord, TICK_RING_SIZE> ring;
+  std::atomic<bool> recording{ false };
+  std::atomic<uint32_t> dropped{ 0 };
+  uint32_t period_us = 0;
+  uint64_t last_push_us = 0;
+};
+
+#endif  // TICK_RECORDER_H
@@ -0,0 +1,138 @@
+#ifndef TWIST_LIMITER_H
+#define TWIST_LIMITER_H
+
+#include <cstdint>
+
+#include "pid_kernel/pid_kernel.h"
+#include "utils.h"
+
+/**
+ * Body velocity setpoints, a linear velocity v and an angular velocity w, turned into wheel speed setpoints
+ * at the control rate: left = v - w * wheel_base / 2, right = v + w * wheel_base / 2.
+ *
+ * Limits apply to (v, w) as a whole, never to one wheel, so that they change how fast the robot drives a
+ * path but not the path. A target that would take a wheel over max_wheel_speed is scaled down, v and w
+ * together, until the faster wheel is at the limit. The setpoints then move towards the target on a straight
+ * line in (v, w), at most linear_accel and angular_accel fast, so a robot starting from rest or coming to a
+ * stop keeps its curvature too. A limit of zero turns that limit off.
+ */
+template <typename T>
+class TwistLimiter
+{
+public:
+  void setLimits(float max_wheel_speed, float linear_accel, float angular_accel)
+  {
+    max_speed = T(max_wheel_speed);
+    accel_v = T(linear_accel);
+    accel_w = T(angular_accel);
+  }
+
+  /* m, WHEEL_BASE until set */
+  void setWheelBase(float wheel_base)
+  {
+    half_base = T(wheel_base / 2.0f);
+  }
+
+  /*
+  Sets a new target.
+  @param[in] current_l, current_r the setpoints in use now, where the ramp starts from unless a twist was
+  already being followed
+  */
+  void setTarget(T linear, T angular, T current_l, T current_r)
+  {
+    if (!is_active)
+    {
+      v = (current_l + current_r) / T(2);
+      w = (current_r - current_l) / (half_base + half_base);
+      is_active = true;
+    }
+    target_v = linear;
+    target_w = angular;
+  }
+
+  /* Leaves twist mode, e.g. for a plain speed_l / speed_r setpoint */
+  void clear()
+  {
+    is_active = false;
+  }
+
+  bool active() const
+  {
+    return is_active;
+  }
+
+  /* How often a target was scaled down to max_wheel_speed */
+  uint32_t saturations() const
+  {
+    return saturation_count;
+  }
+
+  /*
+  Call once per control period while active().
+  @param[out] desired_l, desired_r the setpoints for this period
+  */
+  void update(const ControlTiming<T> &timing, T &desired_l, T &desired_r)
+  {
+    const T zero{};
+    T goal_v = target_v;
+    T goal_w = target_w;
+    T half_turn = absolute(goal_w) * half_base;
+    T fastest = absolute(goal_v) + half_turn;
+    if (max_speed != zero && fastest > max_speed)
+    {
+      if (!is_saturated)
+      {
+        is_saturated = true;
+        ++saturation_count;
+      }
+      T scale = max_speed / fastest;
+      goal_v = goal_v * scale;
+      goal_w = goal_w * scale;
+    }
+    else
+    {
+      is_saturated = false;
+    }
+
+    // the largest fraction of the way to the goal that keeps both accelerations within their limits
+    T d_v = goal_v - v;
+    T d_w = goal_w - w;
+    T fraction(1);
+    if (accel_v != zero && absolute(d_v) > accel_v * timing.d_t_sec)
+    {
+      fraction = accel_v * timing.d_t_sec / absolute(d_v);
+    }
+    if (accel_w != zero && absolute(d_w) * fraction > accel_w * timing.d_t_sec)
+    {
+      fraction = accel_w * timing.d_t_sec / absolute(d_w);
+    }
+    if (fraction == T(1))
+    {
+      v = goal_v;
+      w = goal_w;
+    }
+    else
+    {
+      v += d_v * fraction;
+      w += d_w * fraction;
+    }
+
+    desired_l = v - w * half_base;
+    desired_r = v + w * half_base;
+  }
+
+private:
+  T half_base{ WHEEL_BASE / 2.0f };
+  T max_speed{};
+  T accel_v{};
+  T accel_w{};
+  T target_v{};
+  T target_w{};
+  T v{};  // the setpoints of the last period
+  T w{};
+  bool is_active = false;
+  bool is_saturated = false;
+  uint32_t saturation_count = 0;
+};
+
+#endif  // TWIST_LIMITER_H
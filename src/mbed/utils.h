@@ -1,8 +1,9 @@
 #ifndef FIRMWARE_UTIL
 #define FIRMWARE_UTIL
 
-#include "mbed.h"
+#include "hal/hal.h"
 #include "igvc.pb.h"
+#include "fixed_point/fixed_point.h"
 
 /**
  * For defining constants used by main.cpp
@@ -13,16 +14,136 @@ constexpr bool DEBUG = false;
 
 /* ethernet setup variables */
 constexpr int SERVER_PORT = 5333;
-constexpr int BUFFER_SIZE = 256;
 constexpr const char* MBED_IP = "192.168.1.20";
 constexpr const char* NETMASK = "255.255.255.0";
 constexpr const char* COMPUTER_IP = "192.168.1.21";
 
+/* Transport the requests arrive on. Both listen on SERVER_PORT */
+enum class Transport
+{
+  TCP,  // length-prefixed stream, up to MAX_SESSIONS clients at once
+  UDP   // one request per datagram, see CommandFilter
+};
+constexpr Transport TRANSPORT = Transport::TCP;
+// UDP requests delayed by more than this relative to the fastest one seen are dropped
+constexpr int UDP_MAX_COMMAND_DELAY_MS = 50;
+// e-stop if no UDP request arrives for this long; only then may another address become the host
+constexpr int UDP_SESSION_TIMEOUT_MS = 500;
+// how often an idle network loop wakes up to push telemetry
+constexpr int NETWORK_POLL_MS = 10;
+// Events the network loop can have queued at once, see g_network_queue
+constexpr int NETWORK_QUEUE_EVENTS = 8;
+
+/* TCP sessions, see serveTcp() */
+// Concurrent TCP clients: one commander, the others read-only observers. Each needs a socket, see
+// lwip.tcp-socket-max in mbed_app.json
+constexpr int MAX_SESSIONS = 4;
+// The commander loses control, and the motors stop, when it sends nothing for this long
+constexpr int COMMANDER_TIMEOUT_MS = 500;
+// Clients that neither send requests nor receive pushes are disconnected after this long
+constexpr int SESSION_IDLE_TIMEOUT_MS = 5000;
+// lwIP sends 9 keepalive probes before giving up, so a dead peer is dropped after 1 + 9 * 0.25 s
+constexpr int TCP_KEEPALIVE_IDLE_MS = 1000;
+constexpr int TCP_KEEPALIVE_INTERVAL_MS = 250;
+// largest encoded ResponseMessage, plus its length prefix
+constexpr size_t RESPONSE_BUFFER_SIZE = ResponseMessage_size + 5;
+// largest encoded RequestMessage; UDP datagrams carry one without a prefix, see RequestFramer for TCP
+constexpr size_t REQUEST_BUFFER_SIZE = RequestMessage_size;
+
+/* failsafes */
+// Setpoints older than this are ramped down to zero by the control loop, see CommandTimeout
+constexpr int COMMAND_TIMEOUT_MS = 250;
+constexpr float COMMAND_TIMEOUT_DECEL = 2.0f;  // m/s^2
+
+/* trajectory following, see SetpointQueue */
+// Points queued ahead at most; a request carries up to 8, see igvc.options
+constexpr uint32_t TRAJECTORY_QUEUE_SIZE = 16;
+// Points further ahead of their request's arrival are dropped. Only requests reset the command timeout, so
+// the wheels could never get there without another request anyway
+constexpr int TRAJECTORY_HORIZON_MS = COMMAND_TIMEOUT_MS;
+// Defaults of the limits on the interpolated setpoints, until different ones are saved to flash
+constexpr float TRAJECTORY_ACCEL_LIMIT = 3.0f;  // m/s^2
+constexpr float TRAJECTORY_JERK_LIMIT = 30.0f;  // m/s^3
+
+/* twist setpoints, see TwistLimiter */
+// Defaults of the limits on twists, until different ones are saved to flash. A little below the wheels' top
+// speed, so that the controllers keep some command to correct with
+constexpr float TWIST_MAX_WHEEL_SPEED = 1.8f;  // m/s
+constexpr float TWIST_LINEAR_ACCEL = 1.5f;     // m/s^2
+constexpr float TWIST_ANGULAR_ACCEL = 4.0f;    // rad/s^2
+// The chip resets unless the control loop runs at least this often
+constexpr uint32_t WATCHDOG_TIMEOUT_MS = 100;
+// Erasing a flash sector keeps interrupts off for ~100 ms, so the watchdog is relaxed while saving parameters
+constexpr uint32_t PARAM_SAVE_WATCHDOG_MS = 1000;
+
+/* clock synchronization with the commander, see ClockSync */
+// Exchanges delayed by more than this beyond the fastest recent one are not used, as their delay was most likely
+// not the same both ways
+constexpr int64_t CLOCK_SYNC_MAX_EXTRA_DELAY_US = 500;
+// An exchange this far off the estimate means a clock was set; the estimate starts over from it
+constexpr int64_t CLOCK_SYNC_STEP_US = 20000;
+
+/* system identification, see SystemIdentifier */
+// A run is aborted as soon as a wheel is faster than this, m/s
+constexpr float SYSID_SPEED_LIMIT = 2.5f;
+constexpr uint32_t SYSID_MAX_DURATION_MS = 60000;
+// Bit length of SYSID_PRBS, about a quarter of the wheels' time constant
+constexpr uint32_t SYSID_PRBS_BIT_US = 50000;
+// SYSID_RELAY switches at setpoint +- this, m/s, so that speed noise doesn't make it chatter
+constexpr float SYSID_RELAY_HYSTERESIS = 0.03f;
+// Relay cycles left out of the measurement while the oscillation builds up
+constexpr uint32_t SYSID_RELAY_SETTLE_CYCLES = 2;
+// The proposed IMC gains aim for a closed loop this much faster than the wheel, but no faster than its dead time
+constexpr float SYSID_IMC_LAMBDA_RATIO = 0.5f;
+
+/* battery monitor, see BatteryMonitor */
+// battery voltage at the 3.3 V full scale of the ADC, through the 470k / 51k divider on p19
+constexpr uint32_t BATTERY_FULL_SCALE_MV = 3300 * 521 / 51;
+// conversions per block; with one conversion per control period that is 12.5 blocks a second
+constexpr uint32_t BATTERY_OVERSAMPLE = 16;
+// the filter moves a quarter of the way to each block, i.e. settles in about a third of a second
+constexpr uint32_t BATTERY_FILTER_SHIFT = 2;
+// a 24 V lead-acid pack at about 10% charge, and how far it has to recover to not be low anymore
+constexpr uint32_t BATTERY_LOW_MV = 23000;
+constexpr uint32_t BATTERY_HYSTERESIS_MV = 500;
+
 /* calculation constants */
 constexpr double WHEEL_CIRCUM = 1.092;
 constexpr double GEAR_RATIO = 32.0;
 constexpr int TICKS_PER_REV = 48;
 constexpr double METERS_PER_TICK = WHEEL_CIRCUM / (TICKS_PER_REV * GEAR_RATIO);
+// Distance between the contact patches of the two drive wheels, until a different PARAM_WHEEL_BASE is saved to flash
+constexpr float WHEEL_BASE = 0.8f;
+
+/* sabertooth setup */
+// Must match the DIP switches; simplified serial supports 2400, 9600, 19200 and 38400 baud
+constexpr int SABERTOOTH_BAUD = 9600;
+// Unchanged motor commands are resent this often
+constexpr int SABERTOOTH_KEEPALIVE_MS = 100;
+
+/* control loop timing */
+// Period of the fixed-rate velocity loop. 5000us (200 Hz) down to 1000us (1 kHz) are sensible values.
+constexpr int CONTROL_PERIOD_US = 5000;
+constexpr uint32_t CONTROL_TICK_FLAG = 0x1;
+constexpr uint32_t ESTOP_FLAG = 0x2;  // set by the e-stop interrupt, see onEstopPressed()
+constexpr uint32_t CONTROL_THREAD_STACK_SIZE = 4096;
+// Ticks recorded for push telemetry, 2.5 s at 200 Hz. Lives in AHB SRAM, see g_tick_recorder
+constexpr uint32_t TICK_RING_SIZE = 512;
+
+/* control law */
+// Scalar type of the velocity loop. Q16_16 avoids soft-float on the FPU-less Cortex-M3, float is the reference.
+using ControlScalar = Q16_16;
+// Defaults of the PidTuning parameters, until different ones are saved to flash, see ParamRegistry
+constexpr float PID_DERIVATIVE_ALPHA = 0.75f;
+constexpr float PID_INTEGRAL_CLAMP = 60.0f;  // output units, i.e. the integral is clamped to +-60 / k_i
+constexpr float PID_DEADBAND = 0.16f;        // m/s
+constexpr float PI_BACK_CALC_GAIN = 10.0f;   // 1/s, how fast CONTROLLER_PI_BACK_CALC unwinds its integral
+// Largest motor command magnitude the Sabertooth accepts, see SaberToothController::setSpeeds()
+constexpr int MOTOR_COMMAND_LIMIT = 63;
+// Without an edge for this long a wheel is considered stopped
+constexpr int32_t VELOCITY_EDGE_TIMEOUT_US = 200000;
+// Print the per-iteration cycle cost of every controller, in float and in fixed-point, at startup
+constexpr bool BENCHMARK_PID = false;
 
 
 /**
@@ -34,6 +155,12 @@ struct PIDCoeffs
   float k_i = 0.0f;
   float k_d = 0.0f;
   float k_kv = 0.0f;
+  float k_a = 0.0f;  // acceleration feed forward, only used by CONTROLLER_FEEDFORWARD
+
+  bool operator!=(const PIDCoeffs &other) const
+  {
+    return k_p != other.k_p || k_i != other.k_i || k_d != other.k_d || k_kv != other.k_kv || k_a != other.k_a;
+  }
 };
 
 struct MotorCoeffs
@@ -42,10 +169,19 @@ struct MotorCoeffs
   PIDCoeffs right{};
 };
 
+/* Shape of the control law, the same for both wheels */
+struct PidTuning
+{
+  float derivative_alpha = PID_DERIVATIVE_ALPHA;
+  float integral_clamp = PID_INTEGRAL_CLAMP;
+  float deadband = PID_DEADBAND;
+  float back_calc_gain = PI_BACK_CALC_GAIN;
+};
+
 struct MotorStatus
 {
-  float desired_speed = 0.0f;
-  float actual_speed = 0.0f;
+  ControlScalar desired_speed{};
+  ControlScalar actual_speed{};
   uint32_t ctrl_output = 0;
 };
 
@@ -55,4 +191,27 @@ struct MotorStatusPair
   MotorStatus right{};
 };
 
+/**
+ * Period statistics of the control loop, accumulated between two responses to one client
+ */
+struct LoopTiming
+{
+  int32_t min_period_us = INT32_MAX;
+  int32_t max_period_us = 0;
+  int32_t max_jitter_us = 0;
+
+  void add(int32_t period_us, int32_t jitter_us)
+  {
+    min_period_us = period_us < min_period_us ? period_us : min_period_us;
+    max_period_us = period_us > max_period_us ? period_us : max_period_us;
+    max_jitter_us = jitter_us > max_jitter_us ? jitter_us : max_jitter_us;
+  }
+
+  /* false if no period was added since construction */
+  bool ticked() const
+  {
+    return min_period_us != INT32_MAX;
+  }
+};
+
 #endif //FIRMWARE_UTIL
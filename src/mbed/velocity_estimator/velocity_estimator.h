@@ -0,0 +1,104 @@
+#ifndef VELOCITY_ESTIMATOR_H
+#define VELOCITY_ESTIMATOR_H
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "encoder_pair/encoder_pair.h"
+#include "pid_kernel/pid_kernel.h"
+#include "utils.h"
+
+/**
+ * Wheel speed estimate by the M/T method: the edges counted since the last edge of an earlier period,
+ * divided by the time they actually span, i.e. from that edge to the last one.
+ *
+ * Counting ticks per period alone (the M-method) is quantized to ~0.14 m/s per tick in a 5 ms period,
+ * and timing single edges (the T-method) is noisy at speed; dividing by the edges' own span is exact at
+ * any speed, as both ends of the interval are edges. When no edge arrives, the speed can be at most one
+ * tick per time since the last edge, which makes the estimate decay smoothly to zero.
+ */
+template <typename T>
+class VelocityEstimator
+{
+public:
+  /* Feed every edge drained from the EncoderPair since the last call to estimate() */
+  void addEdge(const EncoderEdge &edge)
+  {
+    if (!has_edge)
+    {
+      // the very first edge only starts the interval
+      span_start = edge;
+      last_edge = edge;
+      has_edge = true;
+      ++edges_in_period;
+      return;
+    }
+    reversed = edge.direction != last_edge.direction;
+    last_edge = edge;
+    net_edges += edge.direction;
+    ++edges_in_period;
+  }
+
+  /*
+  @param[in] ticks net ticks counted during the period
+  @param[in] now_us hal::readMicros() at the end of the period
+  @param[in] period_us length of the period
+  @return speed in m/s
+  */
+  T estimate(int32_t ticks, uint64_t now_us, int32_t period_us)
+  {
+    int32_t edges = edges_in_period;
+    int32_t net = net_edges;
+    edges_in_period = 0;
+    net_edges = 0;
+
+    if (edges < std::abs(ticks))
+    {
+      // edges were lost to a full ring, only the count is complete
+      last_estimate = speedFromTicks<T>(ticks, period_us);
+      span_start = last_edge;
+    }
+    else if (edges > 0)
+    {
+      // A direction change at the last edge means the wheel is passing through zero
+      auto span_us = static_cast<int64_t>(last_edge.time_us - span_start.time_us);
+      last_estimate = reversed || span_us <= 0 || span_us > INT32_MAX
+                          ? T()
+                          : speedFromTicks<T>(net, static_cast<int32_t>(span_us));
+      span_start = last_edge;
+    }
+    else if (has_edge)
+    {
+      // No edge this period: the speed is at most one tick since the last edge
+      uint64_t since_edge_us = now_us - last_edge.time_us;
+      if (now_us <= last_edge.time_us || since_edge_us >= static_cast<uint64_t>(VELOCITY_EDGE_TIMEOUT_US))
+      {
+        last_estimate = T();
+      }
+      else
+      {
+        T bound = speedFromTicks<T>(last_edge.direction, static_cast<int32_t>(since_edge_us));
+        if (absolute(bound) < absolute(last_estimate))
+        {
+          last_estimate = bound;
+        }
+      }
+    }
+    else
+    {
+      last_estimate = T();
+    }
+    return last_estimate;
+  }
+
+private:
+  EncoderEdge span_start{ 0, 0 };  // the last edge of an earlier period, where the interval starts
+  EncoderEdge last_edge{ 0, 0 };
+  bool has_edge = false;
+  bool reversed = false;  // the last edge's direction differs from the one before it
+  int32_t edges_in_period = 0;
+  int32_t net_edges = 0;  // sum of the directions of the edges since span_start
+  T last_estimate{};
+};
+
+#endif  // VELOCITY_ESTIMATOR_H
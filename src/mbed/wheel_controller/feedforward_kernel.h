@@ -0,0 +1,101 @@
+#ifndef FEEDFORWARD_KERNEL_H
+#define FEEDFORWARD_KERNEL_H
+
+#include "pid_kernel/pid_kernel.h"
+
+/**
+ * Model-based kernel: most of the command comes from feed forward on the setpoint, k_kv * v + k_a * dv/dt,
+ * and a PI term only corrects what the model misses.
+ *
+ * The setpoint acceleration is its difference between periods, low passed like PidKernel's derivative. A
+ * step in the setpoint makes it spike for a few periods, so k_a pays off with ramped setpoints, e.g. from a
+ * host side trajectory. The integral is clamped like PidKernel's.
+ */
+template <typename T>
+class FeedforwardKernel
+{
+public:
+  void setCoeffs(const PIDCoeffs &coeffs)
+  {
+    k_p = T(coeffs.k_p);
+    k_i = T(coeffs.k_i);
+    k_kv = T(coeffs.k_kv);
+    k_a = T(coeffs.k_a);
+    k_i_float = coeffs.k_i;
+    updateIntegralClamp();
+  }
+
+  void setTuning(const PidTuning &tuning)
+  {
+    alpha = T(tuning.derivative_alpha);
+    one_minus_alpha = T(1.0f - tuning.derivative_alpha);
+    deadband = T(tuning.deadband);
+    integral_clamp = tuning.integral_clamp;
+    updateIntegralClamp();
+  }
+
+  void resetIntegral()
+  {
+    i_error = T();
+  }
+
+  /*
+  Starts over from the current speeds, as if the setpoint had been desired_speed for a while. The integral is
+  set so that the output carries on from command, within the clamp; without an integral term it can't be
+  @param[in] command the last command of the law this one takes over from
+  */
+  void reset(T desired_speed, T actual_speed, T command)
+  {
+    accel = T();
+    desired_speed_last = desired_speed;
+    i_error = T();
+    if (has_i_clamp)
+    {
+      T error = desired_speed - actual_speed;
+      i_error = (command - k_kv * desired_speed - k_p * error) / k_i;
+      i_error = i_error > i_clamp ? i_clamp : (i_error < -i_clamp ? -i_clamp : i_error);
+    }
+  }
+
+  int update(T desired_speed, T actual_speed, const ControlTiming<T> &timing)
+  {
+    accel = alpha * (desired_speed - desired_speed_last) * timing.rate_hz + one_minus_alpha * accel;
+    desired_speed_last = desired_speed;
+
+    T error = desired_speed - actual_speed;
+    i_error += error * timing.d_t_sec;
+    if (has_i_clamp)
+    {
+      i_error = i_error > i_clamp ? i_clamp : (i_error < -i_clamp ? -i_clamp : i_error);
+    }
+
+    T command = k_kv * desired_speed + k_a * accel + k_p * error + k_i * i_error;
+    return applyDeadband(roundToInt(command), desired_speed, actual_speed, deadband);
+  }
+
+private:
+  void updateIntegralClamp()
+  {
+    has_i_clamp = k_i_float != 0.0f;
+    i_clamp = has_i_clamp ? T(integral_clamp / k_i_float) : T();
+  }
+
+  T alpha = T(PID_DERIVATIVE_ALPHA);
+  T one_minus_alpha = T(1.0f - PID_DERIVATIVE_ALPHA);
+  T deadband = T(PID_DEADBAND);
+  float integral_clamp = PID_INTEGRAL_CLAMP;
+  float k_i_float = 0.0f;
+
+  T k_p{};
+  T k_i{};
+  T k_kv{};
+  T k_a{};
+  T i_clamp{};
+  bool has_i_clamp = false;
+
+  T i_error{};
+  T accel{};
+  T desired_speed_last{};
+};
+
+#endif  // FEEDFORWARD_KERNEL_H
@@ -0,0 +1,73 @@
+#ifndef LQR_KERNEL_H
+#define LQR_KERNEL_H
+
+#include "pid_kernel/pid_kernel.h"
+
+/**
+ * State feedback on a 2-state model of one wheel, x = [speed error, integral of the speed error]:
+ * u = k_kv * r + K x with K = [k_p, k_i].
+ *
+ * K is meant to be the LQR gain of the identified first order wheel model augmented with the integral
+ * state, solved offline by the host for its choice of weights; the firmware only applies it. Instead of a
+ * clamp, the integral state stops integrating while the command is saturated in the direction the error
+ * pushes it (conditional integration).
+ */
+template <typename T>
+class LqrKernel
+{
+public:
+  void setCoeffs(const PIDCoeffs &coeffs)
+  {
+    k_e = T(coeffs.k_p);
+    k_z = T(coeffs.k_i);
+    k_kv = T(coeffs.k_kv);
+  }
+
+  void setTuning(const PidTuning &tuning)
+  {
+    deadband = T(tuning.deadband);
+  }
+
+  void resetIntegral()
+  {
+    z = T();
+  }
+
+  /*
+  Starts over from the current speeds; only the integral state has history. It is set so that the output
+  carries on from command, unless there is no integral action
+  @param[in] command the last command of the law this one takes over from
+  */
+  void reset(T desired_speed, T actual_speed, T command)
+  {
+    resetIntegral();
+    if (k_z != T())
+    {
+      z = (command - k_kv * desired_speed - k_e * (desired_speed - actual_speed)) / k_z;
+    }
+  }
+
+  int update(T desired_speed, T actual_speed, const ControlTiming<T> &timing)
+  {
+    T error = desired_speed - actual_speed;
+    T command = k_kv * desired_speed + k_e * error + k_z * z;
+    T saturated = clampCommand(command);
+    const T zero{};
+    bool winding_up = (command > saturated && error > zero) || (command < saturated && error < zero);
+    if (!winding_up)
+    {
+      z += error * timing.d_t_sec;
+    }
+    return applyDeadband(roundToInt(saturated), desired_speed, actual_speed, deadband);
+  }
+
+private:
+  T k_e{};
+  T k_z{};
+  T k_kv{};
+  T deadband = T(PID_DEADBAND);
+
+  T z{};
+};
+
+#endif  // LQR_KERNEL_H
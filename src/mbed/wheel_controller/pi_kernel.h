@@ -0,0 +1,68 @@
+#ifndef PI_KERNEL_H
+#define PI_KERNEL_H
+
+#include "pid_kernel/pid_kernel.h"
+
+/**
+ * PI velocity kernel with back-calculation anti-windup, plus the velocity feed forward of PidKernel.
+ *
+ * The integral is kept in output units. Whenever the command saturates, the excess is fed back into it with
+ * gain k_t (PidTuning::back_calc_gain, 1/s), so it unwinds as soon as the command can leave saturation
+ * instead of sitting at a fixed clamp. There is no derivative term, which makes it cheaper than PidKernel.
+ */
+template <typename T>
+class PiKernel
+{
+public:
+  void setCoeffs(const PIDCoeffs &coeffs)
+  {
+    k_p = T(coeffs.k_p);
+    k_i = T(coeffs.k_i);
+    k_kv = T(coeffs.k_kv);
+  }
+
+  void setTuning(const PidTuning &tuning)
+  {
+    k_t = T(tuning.back_calc_gain);
+    deadband = T(tuning.deadband);
+  }
+
+  void resetIntegral()
+  {
+    i_term = T();
+  }
+
+  /*
+  Starts over from the current speeds; only the integral has history. It is set so that the output carries on
+  from command, unless there is no integral action
+  @param[in] command the last command of the law this one takes over from
+  */
+  void reset(T desired_speed, T actual_speed, T command)
+  {
+    resetIntegral();
+    if (k_i != T())
+    {
+      i_term = command - k_kv * desired_speed - k_p * (desired_speed - actual_speed);
+    }
+  }
+
+  int update(T desired_speed, T actual_speed, const ControlTiming<T> &timing)
+  {
+    T error = desired_speed - actual_speed;
+    T command = k_kv * desired_speed + k_p * error + i_term;
+    T saturated = clampCommand(command);
+    i_term += (k_i * error + k_t * (saturated - command)) * timing.d_t_sec;
+    return applyDeadband(roundToInt(saturated), desired_speed, actual_speed, deadband);
+  }
+
+private:
+  T k_p{};
+  T k_i{};
+  T k_kv{};
+  T k_t = T(PI_BACK_CALC_GAIN);
+  T deadband = T(PID_DEADBAND);
+
+  T i_term{};
+};
+
+#endif  // PI_KERNEL_H
@@ -0,0 +1,117 @@
+#ifndef WHEEL_CONTROLLER_H
+#define WHEEL_CONTROLLER_H
+
+#include "igvc.pb.h"
+#include "pid_kernel/pid_kernel.h"
+#include "wheel_controller/feedforward_kernel.h"
+#include "wheel_controller/lqr_kernel.h"
+#include "wheel_controller/pi_kernel.h"
+
+/**
+ * The velocity controller of one wheel, running whichever control law (see ControllerType) is selected.
+ *
+ * Every law is a kernel with the same interface: setCoeffs(), setTuning(), resetIntegral(), reset() and
+ * update(). They are all held by value and update() picks one with a switch, so each call is a direct,
+ * inlinable call and there are no virtual functions. Gains and tuning go to every kernel, but only the
+ * selected one runs, so the history of the others (integrals, and the last speeds their derivative and
+ * acceleration terms difference against) goes stale. Switching laws therefore reset()s the new one from the
+ * speeds and the command of the last update(), with its integral chosen so that its first command is the old
+ * law's. That takes over without a kick as long as the new law has an integral term wide enough to make up the
+ * difference; a law without one jumps to its proportional and feed forward command.
+ */
+template <typename T>
+class WheelController
+{
+public:
+  void select(ControllerType type)
+  {
+    if (type == controller_type)
+    {
+      return;
+    }
+    controller_type = type;
+    // what the Sabertooth got
+    const T command = clampCommand(T(command_last));
+    switch (controller_type)
+    {
+      case ControllerType_CONTROLLER_PI_BACK_CALC:
+        pi.reset(desired_speed_last, actual_speed_last, command);
+        break;
+      case ControllerType_CONTROLLER_FEEDFORWARD:
+        feedforward.reset(desired_speed_last, actual_speed_last, command);
+        break;
+      case ControllerType_CONTROLLER_LQR:
+        lqr.reset(desired_speed_last, actual_speed_last, command);
+        break;
+      case ControllerType_CONTROLLER_PID:
+      default:
+        pid.reset(desired_speed_last, actual_speed_last, command);
+        break;
+    }
+  }
+
+  ControllerType type() const
+  {
+    return controller_type;
+  }
+
+  void setCoeffs(const PIDCoeffs &coeffs)
+  {
+    pid.setCoeffs(coeffs);
+    pi.setCoeffs(coeffs);
+    feedforward.setCoeffs(coeffs);
+    lqr.setCoeffs(coeffs);
+  }
+
+  void setTuning(const PidTuning &tuning)
+  {
+    pid.setTuning(tuning);
+    pi.setTuning(tuning);
+    feedforward.setTuning(tuning);
+    lqr.setTuning(tuning);
+  }
+
+  void resetIntegral()
+  {
+    pid.resetIntegral();
+    pi.resetIntegral();
+    feedforward.resetIntegral();
+    lqr.resetIntegral();
+  }
+
+  /* @return the motor command, before the Sabertooth's own clamping */
+  int update(T desired_speed, T actual_speed, const ControlTiming<T> &timing)
+  {
+    desired_speed_last = desired_speed;
+    actual_speed_last = actual_speed;
+    switch (controller_type)
+    {
+      case ControllerType_CONTROLLER_PI_BACK_CALC:
+        command_last = pi.update(desired_speed, actual_speed, timing);
+        break;
+      case ControllerType_CONTROLLER_FEEDFORWARD:
+        command_last = feedforward.update(desired_speed, actual_speed, timing);
+        break;
+      case ControllerType_CONTROLLER_LQR:
+        command_last = lqr.update(desired_speed, actual_speed, timing);
+        break;
+      case ControllerType_CONTROLLER_PID:
+      default:
+        command_last = pid.update(desired_speed, actual_speed, timing);
+        break;
+    }
+    return command_last;
+  }
+
+private:
+  ControllerType controller_type = ControllerType_CONTROLLER_PID;
+  T desired_speed_last{};
+  T actual_speed_last{};
+  int command_last = 0;
+  PidKernel<T> pid;
+  PiKernel<T> pi;
+  FeedforwardKernel<T> feedforward;
+  LqrKernel<T> lqr;
+};
+
+#endif  // WHEEL_CONTROLLER_H